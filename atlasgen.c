@@ -0,0 +1,67 @@
+// build tool: encodes every rect of atlas.h as runs of non-zero coverage per
+// row, with fully opaque runs split out, so the renderer can skip the
+// transparent texels of a glyph and fill its solid parts without blending.
+// writes atlas_spans.h to stdout; the Makefile runs it before renderer.c.
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "microui.h"
+#include "atlas.h"
+
+#define RECTS (int)(sizeof(atlas) / sizeof(*atlas))
+
+typedef struct { int x, len; bool opaque; } run;
+
+static run runs[ATLAS_WIDTH * ATLAS_HEIGHT];
+static int rows[RECTS * (ATLAS_HEIGHT + 1)];
+static int row_start[RECTS];
+
+int main(void) {
+    int nruns = 0, nrows = 0, texels = 0, skipped = 0;
+
+    for (int id = 0; id < RECTS; id++) {
+        mu_Rect r = atlas[id];
+        row_start[id] = nrows;
+        for (int y = 0; y < r.h; y++) {
+            const unsigned char *row = &atlas_texture[(r.y + y) * ATLAS_WIDTH + r.x];
+            rows[nrows++] = nruns;
+            for (int x = 0; x < r.w;) {
+                if (!row[x]) { x++; skipped++; continue; }
+                // a run of the same kind: all 255 or all partial
+                bool opaque = row[x] == 255;
+                int x1 = x;
+                while (x1 < r.w && row[x1] && (row[x1] == 255) == opaque) { x1++; }
+                runs[nruns++] = (run){ x, x1 - x, opaque };
+                texels += x1 - x;
+                x = x1;
+            }
+        }
+        rows[nrows++] = nruns;
+    }
+
+    printf("// generated from atlas.h by atlasgen. do not edit.\n");
+    printf("// %d runs cover %d texels, %d transparent texels skipped.\n\n", nruns, texels, skipped);
+    printf("#ifndef ATLAS_SPANS_H\n#define ATLAS_SPANS_H\n\n");
+    printf("typedef struct {\n");
+    printf("    unsigned char x, len;  // texels from the left edge of the rect\n");
+    printf("    unsigned char opaque;  // every texel of the run is 255\n");
+    printf("} atlas_run;\n\n");
+
+    // row y of rect id holds the runs from atlas_rows[atlas_row_start[id] + y]
+    // up to the next entry
+    printf("static const unsigned short atlas_row_start[%d] = {", RECTS);
+    for (int id = 0; id < RECTS; id++) {
+        printf("%s%d,", id % 16 ? " " : "\n    ", row_start[id]);
+    }
+    printf("\n};\n\nstatic const unsigned short atlas_rows[%d] = {", nrows);
+    for (int i = 0; i < nrows; i++) {
+        printf("%s%d,", i % 16 ? " " : "\n    ", rows[i]);
+    }
+    printf("\n};\n\nstatic const atlas_run atlas_runs[%d] = {", nruns);
+    for (int i = 0; i < nruns; i++) {
+        printf("%s{ %d, %d, %d },", i % 8 ? " " : "\n    ", runs[i].x, runs[i].len, runs[i].opaque);
+    }
+    printf("\n};\n\n#endif\n");
+    return 0;
+}
@@ -0,0 +1,232 @@
+// headless benchmark: builds scripted ui scenes and renders them into a plain
+// memory buffer, no window involved. prints one json object per scene,
+// resolution and stage:
+//
+//   {"scene":"demo","width":800,"height":600,"threads":1,"frames":100,
+//    "stage":"raster","p50_ms":0.412,"p90_ms":0.450,"p99_ms":0.501,"mpix_s":1165.0}
+//
+// usage: uibench [-f frames] [-t threads] [-s scene]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "renderer.h"
+#include "microui.h"
+#include "demo.h"
+#include "logview.h"
+#include "pacer.h"
+
+static char long_text[96 * 1024];
+
+static void demo_scene(mu_Context *ctx, int w, int h) {
+    (void)w, (void)h;
+    demo_windows(ctx);
+}
+
+static void window_grid(mu_Context *ctx, int w, int h, bool retained) {
+    int ww = w / 10, wh = h / 10;
+    for (int i = 0; i < 100; i++) {
+        char title[32];
+        sprintf(title, "Window %d", i);
+        mu_Rect rect = mu_rect(i % 10 * ww, i / 10 * wh, ww, wh);
+        if (retained ? mu_begin_window_retained(ctx, title, rect, 0, 0) : mu_begin_window(ctx, title, rect)) {
+            static int check = 1;
+            mu_layout_row(ctx, 2, (int[]) { 60, -1 }, 0);
+            mu_label(ctx, "Label:");
+            mu_button(ctx, "Button");
+            mu_checkbox(ctx, "Check", &check);
+            mu_end_window(ctx);
+        }
+    }
+}
+
+static void windows_scene(mu_Context *ctx, int w, int h) {
+    window_grid(ctx, w, h, false);
+}
+
+// same windows, replayed from the previous frame unless hovered
+static void retained_scene(mu_Context *ctx, int w, int h) {
+    window_grid(ctx, w, h, true);
+}
+
+static void labels_scene(mu_Context *ctx, int w, int h) {
+    if (mu_begin_window_ex(ctx, "Labels", mu_rect(0, 0, w, h), MU_OPT_NOCLOSE)) {
+        mu_layout_row(ctx, 10, (int[]) { 80, 80, 80, 80, 80, 80, 80, 80, 80, -1 }, 0);
+        for (int i = 0; i < 10000; i++) {
+            char buf[32];
+            sprintf(buf, "label %d", i);
+            mu_label(ctx, buf);
+        }
+        mu_end_window(ctx);
+    }
+}
+
+// a million rows, scrolled to the middle. only the visible ones are laid out
+static void list_scene(mu_Context *ctx, int w, int h) {
+    if (mu_begin_window_ex(ctx, "List", mu_rect(0, 0, w, h), MU_OPT_NOCLOSE)) {
+        mu_Clipper clipper;
+        mu_Container *cnt = mu_get_current_container(ctx);
+        cnt->scroll.y = cnt->content_size.y / 2;
+        mu_layout_row(ctx, 2, (int[]) { 80, -1 }, 0);
+        mu_clipper_begin(ctx, &clipper, 1000000);
+        for (int i = clipper.first; i < clipper.last; i++) {
+            char buf[32];
+            sprintf(buf, "%d", i);
+            mu_label(ctx, buf);
+            sprintf(buf, "row %d", i);
+            mu_label(ctx, buf);
+        }
+        mu_clipper_end(ctx, &clipper);
+        mu_end_window(ctx);
+    }
+}
+
+// a hundred new lines a frame into a full log
+static void log_scene(mu_Context *ctx, int w, int h) {
+    static logview_line lines[4096];
+    static logview lv;
+    static int n;
+    if (!lv.lines) { logview_init(&lv, lines, sizeof(lines) / sizeof(*lines)); }
+    for (int i = 0; i < 100; i++, n++) {
+        char buf[32];
+        sprintf(buf, "line %d", n);
+        logview_append(&lv, n % 17 ? LOGVIEW_INFO : LOGVIEW_WARN, buf);
+    }
+    if (mu_begin_window_ex(ctx, "Log", mu_rect(0, 0, w, h), MU_OPT_NOCLOSE)) {
+        mu_layout_row(ctx, 1, (int[]) { -1 }, -1);
+        logview_panel(ctx, &lv, "Log Output");
+        mu_end_window(ctx);
+    }
+}
+
+static void text_scene(mu_Context *ctx, int w, int h) {
+    if (mu_begin_window_ex(ctx, "Text", mu_rect(0, 0, w, h), MU_OPT_NOCLOSE)) {
+        mu_layout_row(ctx, 1, (int[]) { -1 }, -1);
+        mu_text(ctx, long_text);
+        mu_end_window(ctx);
+    }
+}
+
+static void make_long_text(void) {
+    static const char *words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+        "elit", "maecenas", "lacinia", "sem", "eu", "molestie", "mi", "risus",
+    };
+    int n = sizeof(words) / sizeof(*words);
+    size_t len = 0;
+    unsigned seed = 1;
+    while (len + 16 < sizeof(long_text)) {
+        seed = seed * 1103515245 + 12345;
+        const char *word = words[(seed >> 16) % n];
+        len += sprintf(long_text + len, (seed >> 8) % 13 ? "%s " : "%s\n", word);
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*build)(mu_Context *ctx, int w, int h);
+} scenes[] = {
+    { "demo",        demo_scene     },
+    { "windows100",  windows_scene  },
+    { "retained100", retained_scene },
+    { "labels10k",   labels_scene   },
+    { "list1m",      list_scene     },
+    { "logstream",   log_scene      },
+    { "longtext",    text_scene     },
+};
+
+static const struct { int w, h; } resolutions[] = {
+    { 800, 600 }, { 1920, 1080 }, { 3840, 2160 },
+};
+
+enum { STAGE_UI, STAGE_SUBMIT, STAGE_RASTER, STAGE_TOTAL, STAGE_MAX };
+static const char *stage_names[STAGE_MAX] = { "ui", "submit", "raster", "total" };
+
+static int compare_ns(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const int64_t *sorted, int n, int p) {
+    int i = (n * p + 99) / 100 - 1; // nearest rank
+    return sorted[mu_clamp(i, 0, n - 1)] / 1e6;
+}
+
+static void run(mu_Context *ctx, int scene, int w, int h, int frames, int threads) {
+    uint32_t *buf = calloc((size_t)w * h, sizeof(uint32_t));
+    r_init((r_renderbuffer){ .data = buf, .width = w, .height = h }, threads);
+    demo_init(ctx);
+
+    int64_t *times[STAGE_MAX];
+    for (int s = 0; s < STAGE_MAX; s++) {
+        times[s] = calloc(frames, sizeof(int64_t));
+    }
+
+    // a few frames for microui to settle window order and layout
+    for (int f = -3; f < frames; f++) {
+        int64_t t0 = pacer_now();
+        mu_begin(ctx);
+        scenes[scene].build(ctx, w, h);
+        mu_end(ctx);
+        int64_t t1 = pacer_now();
+        r_clear(demo_bg());
+        demo_render(ctx);
+        int64_t t2 = pacer_now();
+        r_invalidate(); // the frames are identical; measure the full raster, not the damage
+        r_present();
+        int64_t t3 = pacer_now();
+        if (f < 0) { continue; }
+        times[STAGE_UI][f] = t1 - t0;
+        times[STAGE_SUBMIT][f] = t2 - t1;
+        times[STAGE_RASTER][f] = t3 - t2;
+        times[STAGE_TOTAL][f] = t3 - t0;
+    }
+
+    for (int s = 0; s < STAGE_MAX; s++) {
+        int64_t sum = 0;
+        for (int f = 0; f < frames; f++) { sum += times[s][f]; }
+        qsort(times[s], frames, sizeof(int64_t), compare_ns);
+        printf("{\"scene\":\"%s\",\"width\":%d,\"height\":%d,\"threads\":%d,\"frames\":%d,"
+               "\"stage\":\"%s\",\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"mpix_s\":%.1f}\n",
+               scenes[scene].name, w, h, threads, frames, stage_names[s],
+               percentile_ms(times[s], frames, 50), percentile_ms(times[s], frames, 90),
+               percentile_ms(times[s], frames, 99),
+               sum > 0 ? (double)w * h * frames / (sum / 1e9) / 1e6 : 0.0);
+        free(times[s]);
+    }
+    fflush(stdout);
+    mu_free(ctx);
+    free(buf);
+}
+
+int main(int argc, char **argv) {
+    int frames = 100;
+    int threads = 1;
+    const char *only = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-f frames] [-t threads] [-s scene]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    frames = mu_max(frames, 1);
+    make_long_text();
+    mu_Context *ctx = malloc(sizeof(mu_Context));
+    for (int s = 0; s < (int)(sizeof(scenes) / sizeof(*scenes)); s++) {
+        if (only && strcmp(only, scenes[s].name)) { continue; }
+        for (int r = 0; r < (int)(sizeof(resolutions) / sizeof(*resolutions)); r++) {
+            run(ctx, s, resolutions[r].w, resolutions[r].h, frames, threads);
+        }
+    }
+    free(ctx);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DEMO_H
+#define DEMO_H
+
+#include "microui.h"
+
+#include <stdbool.h>
+
+// the demo ui, shared by the windowed app and the headless bench.
+
+// mu_init() plus text measuring through the renderer
+void demo_init(mu_Context *ctx);
+// the demo, log and style windows. call between mu_begin() and mu_end()
+void demo_windows(mu_Context *ctx);
+// the log got a line that the log window has not scrolled to yet
+bool demo_log_pending(void);
+// background color picked in the demo window
+mu_Color demo_bg(void);
+// hands the finished frame's commands to the renderer
+void demo_render(mu_Context *ctx);
+
+#endif
@@ -33,7 +33,12 @@
 #define _DEFAULT_SOURCE 1
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 #include <X11/keysym.h>
+#include <poll.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <time.h>
 #endif
 
@@ -41,11 +46,19 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef FENSTER_MAX_DAMAGE
+#define FENSTER_MAX_DAMAGE 32
+#endif
+
+struct fenster_rect {
+  int x, y, w, h;
+};
+
 struct fenster {
   const char *title;
   const int width;
   const int height;
-  uint32_t *buf;
+  uint32_t *buf; /* left NULL, fenster_open() allocates it (shared with X if it can) */
   int keys[256]; /* keys are mostly ASCII, but arrows are 17..20 */
   int mod;       /* mod is 4 bits mask, ctrl=1, shift=2, alt=4, meta=8 */
   int x;
@@ -53,6 +66,10 @@ struct fenster {
   int mouse;
   float sx;
   float sy;
+  int damaged; /* set by fenster_damage(), only damage[] is uploaded */
+  int ndamage;
+  struct fenster_rect damage[FENSTER_MAX_DAMAGE];
+  int own_buf;
 #if defined(__APPLE__)
   id wnd;
 #elif defined(_WIN32)
@@ -62,6 +79,8 @@ struct fenster {
   Window w;
   GC gc;
   XImage *img;
+  XShmSegmentInfo shm;
+  int use_shm;
 #endif
 };
 
@@ -71,11 +90,75 @@ struct fenster {
 FENSTER_API int fenster_open(struct fenster *f);
 FENSTER_API int fenster_loop(struct fenster *f);
 FENSTER_API void fenster_close(struct fenster *f);
+/* adds rects to upload on the next fenster_loop(). without a call the whole
+   buffer is uploaded; a call with n == 0 uploads nothing. */
+FENSTER_API void fenster_damage(struct fenster *f, const struct fenster_rect *rects, int n);
+/* blocks until there are events for fenster_loop() or timeout_ms passed.
+   a negative timeout waits forever. returns 1 on events, 0 on timeout. */
+FENSTER_API int fenster_wait(struct fenster *f, int timeout_ms);
+/* file descriptor that becomes readable on events, for use in your own
+   poll/epoll loop. -1 where there is none (Cocoa, Win32). */
+FENSTER_API int fenster_fd(struct fenster *f);
 FENSTER_API void fenster_sleep(int64_t ms);
 FENSTER_API int64_t fenster_time(void);
 #define fenster_pixel(f, x, y) ((f)->buf[((y) * (f)->width) + (x)])
 
 #ifndef FENSTER_HEADER
+/* grows a to cover b if the two touch along a full edge or one contains the other */
+static int fenster_rect_merge(struct fenster_rect *a, struct fenster_rect b) {
+  int ax1 = a->x + a->w, ay1 = a->y + a->h, bx1 = b.x + b.w, by1 = b.y + b.h;
+  if (b.x >= a->x && b.y >= a->y && bx1 <= ax1 && by1 <= ay1) {
+    return 1;
+  }
+  if ((a->x >= b.x && a->y >= b.y && ax1 <= bx1 && ay1 <= by1) ||
+      (a->y == b.y && a->h == b.h && b.x <= ax1 && a->x <= bx1) ||
+      (a->x == b.x && a->w == b.w && b.y <= ay1 && a->y <= by1)) {
+    int x = a->x < b.x ? a->x : b.x, y = a->y < b.y ? a->y : b.y;
+    a->w = (ax1 > bx1 ? ax1 : bx1) - x;
+    a->h = (ay1 > by1 ? ay1 : by1) - y;
+    a->x = x, a->y = y;
+    return 1;
+  }
+  return 0;
+}
+
+FENSTER_API void fenster_damage(struct fenster *f, const struct fenster_rect *rects, int n) {
+  f->damaged = 1;
+  for (int i = 0; i < n; i++) {
+    struct fenster_rect r = rects[i];
+    if (r.x < 0) r.w += r.x, r.x = 0;
+    if (r.y < 0) r.h += r.y, r.y = 0;
+    if (r.x + r.w > f->width) r.w = f->width - r.x;
+    if (r.y + r.h > f->height) r.h = f->height - r.y;
+    if (r.w <= 0 || r.h <= 0) {
+      continue;
+    }
+    /* merging can make r touch rects it did not touch before, so start over */
+    for (int j = 0; j < f->ndamage;) {
+      struct fenster_rect m = f->damage[j];
+      if (fenster_rect_merge(&m, r)) {
+        r = m;
+        f->damage[j] = f->damage[--f->ndamage];
+        j = 0;
+      } else {
+        j++;
+      }
+    }
+    if (f->ndamage == FENSTER_MAX_DAMAGE) {
+      /* out of slots: fall back to the bounding box of everything */
+      for (int j = 0; j < f->ndamage; j++) {
+        struct fenster_rect m = f->damage[j];
+        int x1 = r.x + r.w > m.x + m.w ? r.x + r.w : m.x + m.w;
+        int y1 = r.y + r.h > m.y + m.h ? r.y + r.h : m.y + m.h;
+        r.x = r.x < m.x ? r.x : m.x, r.y = r.y < m.y ? r.y : m.y;
+        r.w = x1 - r.x, r.h = y1 - r.y;
+      }
+      f->ndamage = 0;
+    }
+    f->damage[f->ndamage++] = r;
+  }
+}
+
 #if defined(__APPLE__)
 #define msg(r, o, s) ((r(*)(id, SEL))objc_msgSend)(o, sel_getUid(s))
 #define msg1(r, o, s, A, a)                                                    \
@@ -201,6 +284,10 @@ static inline void initialize(void) {
 
 FENSTER_API int fenster_open(struct fenster *f) {
   initialize();
+  if (!f->buf) {
+    f->buf = calloc(f->width * f->height, sizeof(uint32_t));
+    f->own_buf = 1;
+  }
   
   f->wnd = msg4(id, msg(id, cls("NSWindow"), "alloc"),
     "initWithContentRect:styleMask:backing:defer:",
@@ -227,13 +314,26 @@ FENSTER_API int fenster_open(struct fenster *f) {
 
 FENSTER_API void fenster_close(struct fenster *f) {
   msg(void, f->wnd, "close");
+  if (f->own_buf) {
+    free(f->buf);
+  }
 }
 
 // clang-format off
 static const uint8_t FENSTER_KEYCODES[128] = {65,83,68,70,72,71,90,88,67,86,0,66,81,87,69,82,89,84,49,50,51,52,54,53,61,57,55,45,56,48,93,79,85,91,73,80,10,76,74,39,75,59,92,44,47,78,77,46,9,32,96,8,0,27,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,26,2,3,127,0,5,0,4,0,20,19,18,17,0};
 // clang-format on
 FENSTER_API int fenster_loop(struct fenster *f) {
-  msg1(void, msg(id, f->wnd, "contentView"), "setNeedsDisplay:", BOOL, YES);
+  id view = msg(id, f->wnd, "contentView");
+  if (!f->damaged) {
+    msg1(void, view, "setNeedsDisplay:", BOOL, YES);
+  }
+  for (int i = 0; i < f->ndamage; i++) {
+    struct fenster_rect r = f->damage[i];
+    /* the view is not flipped, its origin is bottom left */
+    msg1(void, view, "setNeedsDisplayInRect:", CGRect,
+         CGRectMake(r.x, f->height - r.y - r.h, r.w, r.h));
+  }
+  f->damaged = f->ndamage = 0;
   id event = msg4(id, NSApp,
     "nextEventMatchingMask:untilDate:inMode:dequeue:",
     NSUInteger, NSUIntegerMax,  // nextEventMatchingMask:NSEventMaskAny
@@ -283,6 +383,20 @@ FENSTER_API int fenster_loop(struct fenster *f) {
   msg(void, NSApp, "updateWindows");
   return 0;
 }
+FENSTER_API int fenster_wait(struct fenster *f, int timeout_ms) {
+  (void)f;
+  id date = timeout_ms < 0
+    ? msg(id, cls("NSDate"), "distantFuture")
+    : msg1(id, cls("NSDate"), "dateWithTimeIntervalSinceNow:", double, timeout_ms / 1000.0);
+  id event = msg4(id, NSApp,
+    "nextEventMatchingMask:untilDate:inMode:dequeue:",
+    NSUInteger, NSUIntegerMax,
+    id, date,
+    id, NSDefaultRunLoopMode,
+    BOOL, NO);                  // leave it for fenster_loop()
+  return event != NULL;
+}
+FENSTER_API int fenster_fd(struct fenster *f) { (void)f; return -1; }
 #elif defined(_WIN32)
 // clang-format off
 static const uint8_t FENSTER_KEYCODES[] = {0,27,49,50,51,52,53,54,55,56,57,48,45,61,8,9,81,87,69,82,84,89,85,73,79,80,91,93,10,0,65,83,68,70,71,72,74,75,76,59,39,96,0,92,90,88,67,86,66,78,77,44,46,47,0,0,0,32,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,17,3,0,20,0,19,0,5,18,4,26,127};
@@ -307,7 +421,9 @@ static LRESULT CALLBACK fenster_wndproc(HWND hwnd, UINT msg, WPARAM wParam,
     bi.bmiColors[2].rgbBlue = 0xff;
     SetDIBitsToDevice(memdc, 0, 0, f->width, f->height, 0, 0, 0, f->height,
                       f->buf, (BITMAPINFO *)&bi, DIB_RGB_COLORS);
-    BitBlt(hdc, 0, 0, f->width, f->height, memdc, 0, 0, SRCCOPY);
+    RECT *r = &ps.rcPaint;
+    BitBlt(hdc, r->left, r->top, r->right - r->left, r->bottom - r->top, memdc,
+           r->left, r->top, SRCCOPY);
     SelectObject(memdc, oldbmp);
     DeleteObject(hbmp);
     DeleteDC(memdc);
@@ -343,6 +459,10 @@ static LRESULT CALLBACK fenster_wndproc(HWND hwnd, UINT msg, WPARAM wParam,
 FENSTER_API int fenster_open(struct fenster *f) {
   HINSTANCE hInstance = GetModuleHandle(NULL);
   WNDCLASSEX wc = {0};
+  if (!f->buf) {
+    f->buf = calloc(f->width * f->height, sizeof(uint32_t));
+    f->own_buf = 1;
+  }
   wc.cbSize = sizeof(WNDCLASSEX);
   wc.style = CS_VREDRAW | CS_HREDRAW;
   wc.lpfnWndProc = fenster_wndproc;
@@ -361,7 +481,11 @@ FENSTER_API int fenster_open(struct fenster *f) {
   return 0;
 }
 
-FENSTER_API void fenster_close(struct fenster *f) { (void)f; }
+FENSTER_API void fenster_close(struct fenster *f) {
+  if (f->own_buf) {
+    free(f->buf);
+  }
+}
 
 FENSTER_API int fenster_loop(struct fenster *f) {
   MSG msg;
@@ -371,13 +495,81 @@ FENSTER_API int fenster_loop(struct fenster *f) {
     TranslateMessage(&msg);
     DispatchMessage(&msg);
   }
-  InvalidateRect(f->hwnd, NULL, TRUE);
+  if (!f->damaged) {
+    InvalidateRect(f->hwnd, NULL, TRUE);
+  }
+  for (int i = 0; i < f->ndamage; i++) {
+    struct fenster_rect d = f->damage[i];
+    RECT r = {d.x, d.y, d.x + d.w, d.y + d.h};
+    InvalidateRect(f->hwnd, &r, FALSE);
+  }
+  f->damaged = f->ndamage = 0;
   return 0;
 }
+
+FENSTER_API int fenster_wait(struct fenster *f, int timeout_ms) {
+  (void)f;
+  MSG msg;
+  if (PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE)) {
+    return 1;
+  }
+  DWORD timeout = timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms;
+  return MsgWaitForMultipleObjects(0, NULL, FALSE, timeout, QS_ALLINPUT) == WAIT_OBJECT_0;
+}
+FENSTER_API int fenster_fd(struct fenster *f) { (void)f; return -1; }
 #else
 // clang-format off
 static int FENSTER_KEYCODES[124] = {XK_BackSpace,8,XK_Delete,127,XK_Down,18,XK_End,5,XK_Escape,27,XK_Home,2,XK_Insert,26,XK_Left,20,XK_Page_Down,4,XK_Page_Up,3,XK_Return,10,XK_Right,19,XK_Tab,9,XK_Up,17,XK_apostrophe,39,XK_backslash,92,XK_bracketleft,91,XK_bracketright,93,XK_comma,44,XK_equal,61,XK_grave,96,XK_minus,45,XK_period,46,XK_semicolon,59,XK_slash,47,XK_space,32,XK_a,65,XK_b,66,XK_c,67,XK_d,68,XK_e,69,XK_f,70,XK_g,71,XK_h,72,XK_i,73,XK_j,74,XK_k,75,XK_l,76,XK_m,77,XK_n,78,XK_o,79,XK_p,80,XK_q,81,XK_r,82,XK_s,83,XK_t,84,XK_u,85,XK_v,86,XK_w,87,XK_x,88,XK_y,89,XK_z,90,XK_0,48,XK_1,49,XK_2,50,XK_3,51,XK_4,52,XK_5,53,XK_6,54,XK_7,55,XK_8,56,XK_9,57};
 // clang-format on
+static int fenster_shm_failed;
+static int fenster_shm_error(Display *dpy, XErrorEvent *ev) {
+  (void)dpy, (void)ev;
+  fenster_shm_failed = 1;
+  return 0;
+}
+/* puts the framebuffer in a shared memory segment so that uploads don't go
+   through the socket. fails on remote displays, where the server can't see
+   our memory; XShmAttach only reports that as an async error. */
+static int fenster_shm_open(struct fenster *f) {
+  if (!XShmQueryExtension(f->dpy)) {
+    return -1;
+  }
+  f->img = XShmCreateImage(f->dpy, DefaultVisual(f->dpy, 0), 24, ZPixmap, NULL,
+                           &f->shm, f->width, f->height);
+  if (!f->img) {
+    return -1;
+  }
+  if (f->img->bytes_per_line != f->width * 4) {
+    XDestroyImage(f->img);
+    return -1;
+  }
+  f->shm.shmid = shmget(IPC_PRIVATE, f->img->bytes_per_line * f->height,
+                        IPC_CREAT | 0600);
+  if (f->shm.shmid < 0) {
+    XDestroyImage(f->img);
+    return -1;
+  }
+  f->shm.shmaddr = f->img->data = shmat(f->shm.shmid, NULL, 0);
+  f->shm.readOnly = False;
+  int (*handler)(Display *, XErrorEvent *) = XSetErrorHandler(fenster_shm_error);
+  fenster_shm_failed = f->shm.shmaddr == (char *)-1 || !XShmAttach(f->dpy, &f->shm);
+  XSync(f->dpy, False);
+  XSetErrorHandler(handler);
+  /* the segment goes away once both sides have detached */
+  shmctl(f->shm.shmid, IPC_RMID, NULL);
+  if (fenster_shm_failed) {
+    if (f->shm.shmaddr != (char *)-1) {
+      shmdt(f->shm.shmaddr);
+    }
+    f->img->data = NULL;
+    XDestroyImage(f->img);
+    return -1;
+  }
+  f->buf = (uint32_t *)f->shm.shmaddr;
+  memset(f->buf, 0, f->width * f->height * 4);
+  f->own_buf = 1;
+  return 0;
+}
 FENSTER_API int fenster_open(struct fenster *f) {
   f->dpy = XOpenDisplay(NULL);
   int screen = DefaultScreen(f->dpy);
@@ -391,18 +583,60 @@ FENSTER_API int fenster_open(struct fenster *f) {
   XStoreName(f->dpy, f->w, f->title);
   XMapWindow(f->dpy, f->w);
   XSync(f->dpy, f->w);
+  if (!f->buf && fenster_shm_open(f) == 0) {
+    f->use_shm = 1;
+    return 0;
+  }
+  if (!f->buf) {
+    f->buf = calloc(f->width * f->height, sizeof(uint32_t));
+    f->own_buf = 1;
+  }
   f->img = XCreateImage(f->dpy, DefaultVisual(f->dpy, 0), 24, ZPixmap, 0,
                         (char *)f->buf, f->width, f->height, 32, 0);
   return 0;
 }
-FENSTER_API void fenster_close(struct fenster *f) { XCloseDisplay(f->dpy); }
+FENSTER_API void fenster_close(struct fenster *f) {
+  if (f->use_shm) {
+    XShmDetach(f->dpy, &f->shm);
+    XSync(f->dpy, False);
+    shmdt(f->shm.shmaddr);
+  } else if (f->own_buf) {
+    free(f->buf);
+  }
+  f->img->data = NULL; /* the buffer is gone, don't let X free it */
+  XDestroyImage(f->img);
+  XCloseDisplay(f->dpy);
+}
+static void fenster_put(struct fenster *f, int x, int y, int w, int h) {
+  if (f->use_shm) {
+    XShmPutImage(f->dpy, f->w, f->gc, f->img, x, y, x, y, w, h, False);
+  } else {
+    XPutImage(f->dpy, f->w, f->gc, f->img, x, y, x, y, w, h);
+  }
+}
 FENSTER_API int fenster_loop(struct fenster *f) {
   XEvent ev;
-  XPutImage(f->dpy, f->w, f->gc, f->img, 0, 0, 0, 0, f->width, f->height);
-  XFlush(f->dpy);
+  if (!f->damaged) {
+    fenster_put(f, 0, 0, f->width, f->height);
+  }
+  for (int i = 0; i < f->ndamage; i++) {
+    struct fenster_rect r = f->damage[i];
+    fenster_put(f, r.x, r.y, r.w, r.h);
+  }
+  f->damaged = f->ndamage = 0;
+  if (f->use_shm) {
+    /* the server reads straight from buf; wait for it before we draw again */
+    XSync(f->dpy, False);
+  } else {
+    XFlush(f->dpy);
+  }
   while (XPending(f->dpy)) {
     XNextEvent(f->dpy, &ev);
     switch (ev.type) {
+    case Expose:
+      fenster_put(f, ev.xexpose.x, ev.xexpose.y, ev.xexpose.width,
+                  ev.xexpose.height);
+      break;
     case ButtonPress:
     case ButtonRelease:
       f->mouse = (ev.type == ButtonPress);
@@ -427,6 +661,15 @@ FENSTER_API int fenster_loop(struct fenster *f) {
   }
   return 0;
 }
+FENSTER_API int fenster_wait(struct fenster *f, int timeout_ms) {
+  /* events Xlib already read off the socket won't make it readable again */
+  if (XPending(f->dpy)) {
+    return 1;
+  }
+  struct pollfd pfd = {ConnectionNumber(f->dpy), POLLIN, 0};
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+FENSTER_API int fenster_fd(struct fenster *f) { return ConnectionNumber(f->dpy); }
 #endif
 
 #ifdef _WIN32
@@ -446,7 +689,7 @@ FENSTER_API void fenster_sleep(int64_t ms) {
 }
 FENSTER_API int64_t fenster_time(void) {
   struct timespec time;
-  clock_gettime(CLOCK_REALTIME, &time);
+  clock_gettime(CLOCK_MONOTONIC, &time);
   return time.tv_sec * 1000 + (time.tv_nsec / 1000000);
 }
 #endif
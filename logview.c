@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logview.h"
+#include "pacer.h"
+
+void logview_init(logview *lv, logview_line *lines, int cap) {
+    assert(cap > 0 && (cap & (cap - 1)) == 0);
+    memset(lv, 0, sizeof(*lv));
+    memset(lines, 0, cap * sizeof(*lines));
+    lv->lines = lines;
+    lv->cap = cap;
+    lv->start = pacer_now();
+}
+
+void logview_append(logview *lv, int level, const char *text) {
+    uint64_t n = atomic_fetch_add_explicit(&lv->head, 1, memory_order_relaxed);
+    logview_line *line = &lv->lines[n & (lv->cap - 1)];
+
+    // claim the slot. it can only be busy or newer if the ring wrapped around
+    // while another writer was still at it; this line is then the one to lose
+    uint64_t seq = atomic_load_explicit(&line->seq, memory_order_relaxed);
+    do {
+        if ((seq & 1) || seq > 2 * n) {
+            atomic_fetch_add_explicit(&lv->dropped, 1, memory_order_relaxed);
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&line->seq, &seq, 2 * n + 1,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    atomic_thread_fence(memory_order_release);
+
+    uint64_t words[LOGVIEW_LINE_SIZE / 8] = { 0 };
+    size_t len = strlen(text);
+    memcpy(words, text, len < LOGVIEW_LINE_SIZE - 1 ? len : LOGVIEW_LINE_SIZE - 1);
+    for (int i = 0; i < LOGVIEW_LINE_SIZE / 8; i++) {
+        atomic_store_explicit(&line->text[i], words[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&line->time, pacer_now() - lv->start, memory_order_relaxed);
+    atomic_store_explicit(&line->level, level, memory_order_relaxed);
+
+    atomic_store_explicit(&line->seq, 2 * n + 2, memory_order_release);
+}
+
+// copies line n out, unless it is not written yet, already replaced or being replaced
+static bool read_line(logview *lv, uint64_t n, char *text, int64_t *time, int *level) {
+    logview_line *line = &lv->lines[n & (lv->cap - 1)];
+    uint64_t seq = atomic_load_explicit(&line->seq, memory_order_acquire);
+    if (seq != 2 * n + 2) { return false; }
+
+    uint64_t words[LOGVIEW_LINE_SIZE / 8];
+    for (int i = 0; i < LOGVIEW_LINE_SIZE / 8; i++) {
+        words[i] = atomic_load_explicit(&line->text[i], memory_order_relaxed);
+    }
+    *time = atomic_load_explicit(&line->time, memory_order_relaxed);
+    *level = atomic_load_explicit(&line->level, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&line->seq, memory_order_relaxed) != seq) { return false; }
+    memcpy(text, words, LOGVIEW_LINE_SIZE);
+    return true;
+}
+
+void logview_panel(mu_Context *ctx, logview *lv, const char *name) {
+    static const mu_Color level_colors[] = {
+        [LOGVIEW_WARN]  = { 230, 200, 90, 255 },
+        [LOGVIEW_ERROR] = { 240, 100, 90, 255 },
+    };
+    uint64_t head = atomic_load_explicit(&lv->head, memory_order_acquire);
+    uint64_t count = head < lv->cap ? head : lv->cap;
+    mu_Font font = ctx->style->font;
+    mu_Clipper clipper;
+
+    mu_begin_panel(ctx, name);
+    mu_Container *panel = mu_get_current_container(ctx);
+    mu_layout_row(ctx, 2, (int[]) { 54, -1 }, ctx->text_height(font));
+    mu_clipper_begin(ctx, &clipper, (int)count);
+    for (int i = clipper.first; i < clipper.last; i++) {
+        char text[LOGVIEW_LINE_SIZE], time[32];
+        int64_t ns;
+        int level;
+        mu_Rect r = mu_layout_next(ctx);
+        mu_Rect t = mu_layout_next(ctx);
+        if (!read_line(lv, head - count + i, text, &ns, &level)) { continue; }
+
+        mu_Color color = ctx->style->colors[MU_COLOR_TEXT];
+        mu_Color dim = color;
+        dim.a /= 2;
+        sprintf(time, "%.3f", ns / 1e9);
+        mu_draw_text(ctx, font, time, -1, mu_vec2(r.x, r.y), dim);
+        if (level == LOGVIEW_WARN || level == LOGVIEW_ERROR) { color = level_colors[level]; }
+        mu_draw_text(ctx, font, text, -1, mu_vec2(t.x, t.y), color);
+    }
+    mu_clipper_end(ctx, &clipper);
+    mu_end_panel(ctx);
+
+    if (head != lv->seen) {
+        panel->scroll.y = panel->content_size.y;
+        lv->seen = head;
+    }
+}
+
+bool logview_pending(logview *lv) {
+    return atomic_load_explicit(&lv->head, memory_order_relaxed) != lv->seen;
+}
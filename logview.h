@@ -0,0 +1,43 @@
+#ifndef LOGVIEW_H
+#define LOGVIEW_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "microui.h"
+
+// a scrolling log panel over a fixed ring of lines. any number of threads can
+// append at once without locks; the ui thread reads each line it shows under
+// that line's sequence number and skips it if a writer got in the way.
+// once the ring is full every new line replaces the oldest one.
+
+#define LOGVIEW_LINE_SIZE 128 // bytes per line, longer lines are cut
+
+enum { LOGVIEW_INFO, LOGVIEW_WARN, LOGVIEW_ERROR };
+
+typedef struct {
+    _Atomic uint64_t seq;  // 2 * n + 2 once line n is complete, odd while it is written
+    _Atomic int64_t time;  // ns since logview_init()
+    _Atomic int level;
+    _Atomic uint64_t text[LOGVIEW_LINE_SIZE / 8];
+} logview_line;
+
+typedef struct {
+    logview_line *lines;
+    uint64_t cap;              // power of two
+    _Atomic uint64_t head;     // lines appended so far
+    _Atomic uint64_t dropped;  // lines lost to a writer a whole ring apart
+    int64_t start;
+    uint64_t seen;             // head when the panel last scrolled to the end
+} logview;
+
+// lines is caller storage for cap lines, cap a power of two
+void logview_init(logview *lv, logview_line *lines, int cap);
+void logview_append(logview *lv, int level, const char *text);
+// a panel with the lines in view; scrolls to the end when lines were added
+void logview_panel(mu_Context *ctx, logview *lv, const char *name);
+// lines were added that no panel has scrolled to yet
+bool logview_pending(logview *lv);
+
+#endif
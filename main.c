@@ -1,5 +1,10 @@
+// first: it sets the feature macros the system headers below need to see
+#include "fenster.h"
+
 #include "renderer.h"
 #include "microui.h"
+#include "demo.h"
+#include "pacer.h"
 
 #include <ctype.h>
 #include <stdbool.h>
@@ -8,248 +13,76 @@
 #include <string.h>
 #include <tgmath.h>
 
-#include "fenster.h"
-
-static  char logbuf[64000];
-static   int logbuf_updated = 0;
-static float bg[3] = { 90, 95, 100 };
-
-
-static void write_log(const char *text) {
-    if (logbuf[0]) { strcat(logbuf, "\n"); }
-    strcat(logbuf, text);
-    logbuf_updated = 1;
-}
-
-
-static void test_window(mu_Context *ctx) {
-    /* do window */
-    if (mu_begin_window(ctx, "Demo Window", mu_rect(40, 40, 300, 450))) {
-        mu_Container *win = mu_get_current_container(ctx);
-        win->rect.w = mu_max(win->rect.w, 240);
-        win->rect.h = mu_max(win->rect.h, 300);
-
-        /* window info */
-        if (mu_header(ctx, "Window Info")) {
-            mu_Container *win = mu_get_current_container(ctx);
-            char buf[64];
-            mu_layout_row(ctx, 2, (int[]) { 54, -1 }, 0);
-            mu_label(ctx,"Position:");
-            sprintf(buf, "%d, %d", win->rect.x, win->rect.y); mu_label(ctx, buf);
-            mu_label(ctx, "Size:");
-            sprintf(buf, "%d, %d", win->rect.w, win->rect.h); mu_label(ctx, buf);
-        }
-
-        /* labels + buttons */
-        if (mu_header_ex(ctx, "Test Buttons", MU_OPT_EXPANDED)) {
-            mu_layout_row(ctx, 3, (int[]) { 86, -110, -1 }, 0);
-            mu_label(ctx, "Test buttons 1:");
-            if (mu_button(ctx, "Button 1")) { write_log("Pressed button 1"); }
-            if (mu_button(ctx, "Button 2")) { write_log("Pressed button 2"); }
-            mu_label(ctx, "Test buttons 2:");
-            if (mu_button(ctx, "Button 3")) { write_log("Pressed button 3"); }
-            if (mu_button(ctx, "Popup")) { mu_open_popup(ctx, "Test Popup"); }
-            if (mu_begin_popup(ctx, "Test Popup")) {
-                if (mu_button(ctx, "Hello")) { write_log("pressed Hello"); };
-                if (mu_button(ctx, "World")) { write_log("pressed World"); };
-                if (mu_button(ctx, "Full")) { write_log("pressed Full"); };
-                if (mu_button(ctx, "Beans!")) { write_log("pressed Beans!"); };
-                mu_end_popup(ctx);
-            }
-        }
-
-        /* tree */
-        if (mu_header_ex(ctx, "Tree and Text", MU_OPT_EXPANDED)) {
-            mu_layout_row(ctx, 2, (int[]) { 140, -1 }, 0);
-            mu_layout_begin_column(ctx);
-            if (mu_begin_treenode(ctx, "Test 1")) {
-                if (mu_begin_treenode(ctx, "Test 1a")) {
-                    mu_label(ctx, "Hello");
-                    mu_label(ctx, "world");
-                    mu_end_treenode(ctx);
-                }
-                if (mu_begin_treenode(ctx, "Test 1b")) {
-                    if (mu_button(ctx, "Button 1")) { write_log("Pressed button 1"); }
-                    if (mu_button(ctx, "Button 2")) { write_log("Pressed button 2"); }
-                    mu_end_treenode(ctx);
-                }
-                mu_end_treenode(ctx);
-            }
-            if (mu_begin_treenode(ctx, "Test 2")) {
-                mu_layout_row(ctx, 2, (int[]) { 54, 54 }, 0);
-                if (mu_button(ctx, "Button 3")) { write_log("Pressed button 3"); }
-                if (mu_button(ctx, "Button 4")) { write_log("Pressed button 4"); }
-                if (mu_button(ctx, "Button 5")) { write_log("Pressed button 5"); }
-                if (mu_button(ctx, "Button 6")) { write_log("Pressed button 6"); }
-                mu_end_treenode(ctx);
-            }
-            if (mu_begin_treenode(ctx, "Test 3")) {
-                static int checks[3] = { 1, 0, 1 };
-                mu_checkbox(ctx, "Checkbox 1", &checks[0]);
-                mu_checkbox(ctx, "Checkbox 2", &checks[1]);
-                mu_checkbox(ctx, "Checkbox 3", &checks[2]);
-                mu_end_treenode(ctx);
-            }
-            mu_layout_end_column(ctx);
-
-            mu_layout_begin_column(ctx);
-            mu_layout_row(ctx, 1, (int[]) { -1 }, 0);
-            mu_text(ctx, "Lorem ipsum dolor sit amet, consectetur adipiscing "
-                    "elit. Maecenas lacinia, sem eu lacinia molestie, mi risus faucibus "
-                    "ipsum, eu varius magna felis a nulla.");
-            mu_layout_end_column(ctx);
-        }
-
-        /* background color sliders */
-        if (mu_header_ex(ctx, "Background Color", MU_OPT_EXPANDED)) {
-            mu_layout_row(ctx, 2, (int[]) { -78, -1 }, 74);
-            /* sliders */
-            mu_layout_begin_column(ctx);
-            mu_layout_row(ctx, 2, (int[]) { 46, -1 }, 0);
-            mu_label(ctx, "Red:");   mu_slider(ctx, &bg[0], 0, 255);
-            mu_label(ctx, "Green:"); mu_slider(ctx, &bg[1], 0, 255);
-            mu_label(ctx, "Blue:");  mu_slider(ctx, &bg[2], 0, 255);
-            mu_layout_end_column(ctx);
-            /* color preview */
-            mu_Rect r = mu_layout_next(ctx);
-            mu_draw_rect(ctx, r, mu_color(bg[0], bg[1], bg[2], 255));
-            char buf[32];
-            sprintf(buf, "#%02X%02X%02X", (int) bg[0], (int) bg[1], (int) bg[2]);
-            mu_draw_control_text(ctx, buf, r, MU_COLOR_TEXT, MU_OPT_ALIGNCENTER);
-        }
-
-        mu_end_window(ctx);
-    }
-}
-
+// idle mode only builds a frame when something asks for one
+static  bool idle = false;
+static   int frames_wanted = 1;
 
-static void log_window(mu_Context *ctx) {
-    if (mu_begin_window(ctx, "Log Window", mu_rect(350, 40, 300, 200))) {
-        /* output text panel */
-        mu_layout_row(ctx, 1, (int[]) { -1 }, -25);
-        mu_begin_panel(ctx, "Log Output");
-        mu_Container *panel = mu_get_current_container(ctx);
-        mu_layout_row(ctx, 1, (int[]) { -1 }, -1);
-        mu_text(ctx, logbuf);
-        mu_end_panel(ctx);
-        if (logbuf_updated) {
-            panel->scroll.y = panel->content_size.y;
-            logbuf_updated = 0;
-        }
+#define IDLE_TIMER_MS 1000
 
-        /* input textbox + submit button */
-        static char buf[128];
-        int submitted = 0;
-        mu_layout_row(ctx, 2, (int[]) { -70, -1 }, 0);
-        if (mu_textbox(ctx, buf, sizeof(buf)) & MU_RES_SUBMIT) {
-            mu_set_focus(ctx, ctx->last_id);
-            submitted = 1;
-        }
-        if (mu_button(ctx, "Submit")) { submitted = 1; }
-        if (submitted) {
-            write_log(buf);
-            buf[0] = '\0';
-        }
-
-        mu_end_window(ctx);
-    }
+static void invalidate(int frames) {
+    frames_wanted = mu_max(frames_wanted, frames);
 }
 
 
-static int uint8_slider(mu_Context *ctx, unsigned char *value, int low, int high) {
-    static float tmp;
-    mu_push_id(ctx, &value, sizeof(value));
-    tmp = *value;
-    int res = mu_slider_ex(ctx, &tmp, low, high, 0, "%.0f", MU_OPT_ALIGNCENTER);
-    *value = tmp;
-    mu_pop_id(ctx);
-    return res;
-}
-
-
-static void style_window(mu_Context *ctx) {
-    static struct { const char *label; int idx; } colors[] = {
-        { "text:",         MU_COLOR_TEXT        },
-        { "border:",       MU_COLOR_BORDER      },
-        { "windowbg:",     MU_COLOR_WINDOWBG    },
-        { "titlebg:",      MU_COLOR_TITLEBG     },
-        { "titletext:",    MU_COLOR_TITLETEXT   },
-        { "panelbg:",      MU_COLOR_PANELBG     },
-        { "button:",       MU_COLOR_BUTTON      },
-        { "buttonhover:",  MU_COLOR_BUTTONHOVER },
-        { "buttonfocus:",  MU_COLOR_BUTTONFOCUS },
-        { "base:",         MU_COLOR_BASE        },
-        { "basehover:",    MU_COLOR_BASEHOVER   },
-        { "basefocus:",    MU_COLOR_BASEFOCUS   },
-        { "scrollbase:",   MU_COLOR_SCROLLBASE  },
-        { "scrollthumb:",  MU_COLOR_SCROLLTHUMB },
-        { NULL }
-    };
-
-    if (mu_begin_window(ctx, "Style Editor", mu_rect(350, 250, 300, 240))) {
-        int sw = mu_get_current_container(ctx)->body.w * 0.14;
-        mu_layout_row(ctx, 6, (int[]) { 80, sw, sw, sw, sw, -1 }, 0);
-        for (int i = 0; colors[i].label; i++) {
-            mu_label(ctx, colors[i].label);
-            uint8_slider(ctx, &ctx->style->colors[i].r, 0, 255);
-            uint8_slider(ctx, &ctx->style->colors[i].g, 0, 255);
-            uint8_slider(ctx, &ctx->style->colors[i].b, 0, 255);
-            uint8_slider(ctx, &ctx->style->colors[i].a, 0, 255);
-            mu_draw_rect(ctx, mu_layout_next(ctx), ctx->style->colors[i]);
-        }
-        mu_end_window(ctx);
-    }
-}
-
-int64_t paint_time_ms = 0;
-int64_t frame_budget_ms = 0;
-int64_t sleep_time_ms = 0;
+static pacer frame_pacer;
+static int64_t paint_time_ns = 0;
 
 static void stats_window(mu_Context *ctx) {
-    if (mu_begin_window_ex(ctx, "Stats", mu_rect(10, 10, 150, 128), MU_OPT_NOCLOSE | MU_OPT_NORESIZE)) {
+    if (mu_begin_window_ex(ctx, "Stats", mu_rect(10, 10, 170, 225), MU_OPT_NOCLOSE | MU_OPT_NORESIZE)) {
+        pacer_stats stats = pacer_get_stats(&frame_pacer);
         char buf[64];
         mu_layout_row(ctx, 2, (int[]) { 54, -1 }, 0);
 
         mu_label(ctx, "FPS:");
-        sprintf(buf, "%d", (int)(1.0 / ((paint_time_ms > 0 ? paint_time_ms : 1) + (sleep_time_ms > 0 ? sleep_time_ms : 0)) * 1000.0));
+        sprintf(buf, "%.1f", stats.fps);
         mu_label(ctx, buf);
 
         mu_label(ctx,"Time:");
-        sprintf(buf, "%lld ms / frame", paint_time_ms);
+        sprintf(buf, "%.2f ms / frame", paint_time_ns / 1e6);
         mu_label(ctx, buf);
 
         mu_label(ctx, "Budget:");
-        sprintf(buf, "%lld ms", frame_budget_ms);
+        sprintf(buf, "%.2f ms", frame_pacer.period / 1e6);
         mu_label(ctx, buf);
 
-        mu_label(ctx, "Sleep:");
-        sprintf(buf, "%lld ms", sleep_time_ms);
+        // how late the pacer wakes up for a frame
+        mu_label(ctx, "Jitter:");
+        sprintf(buf, "%.1f us avg", stats.mean_us);
+        mu_label(ctx, buf);
+
+        mu_label(ctx, "Max:");
+        sprintf(buf, "%.1f us", stats.max_us);
+        mu_label(ctx, buf);
+
+        mu_label(ctx, "Stddev:");
+        sprintf(buf, "%.1f us", stats.stddev_us);
+        mu_label(ctx, buf);
+
+        mu_label(ctx, "Missed:");
+        sprintf(buf, "%lld / %lld", (long long)stats.missed, (long long)(stats.frames + stats.missed));
+        mu_label(ctx, buf);
+
+        // share of text drawn from cached masks, and their memory
+        r_text_cache_stats text = r_get_text_cache_stats();
+        uint64_t lookups = text.hits + text.misses;
+        mu_label(ctx, "Text:");
+        sprintf(buf, "%.0f%%, %zu kb", lookups ? 100.0 * text.hits / lookups : 0.0, text.bytes / 1024);
         mu_label(ctx, buf);
 
         mu_end_window(ctx);
     }
 }
 
-static void process_frame(mu_Context *ctx) {
+// returns whether the ui looks any different from the last frame
+static bool process_frame(mu_Context *ctx) {
     mu_begin(ctx);
-    style_window(ctx);
-    log_window(ctx);
-    test_window(ctx);
+    demo_windows(ctx);
     stats_window(ctx);
-    mu_end(ctx);
-}
+    int res = mu_end(ctx);
 
-static int text_width(mu_Font font, const char *text, int len) {
-    if (len == -1) { len = (int)strlen(text); }
-    return r_get_text_width(text, len);
-}
-
-static int text_height(mu_Font font) {
-    return r_get_text_height();
-}
-
-static inline uint32_t r_color(mu_Color clr) {
-    return ((uint32_t)clr.a << 24) | ((uint32_t)clr.r << 16) | ((uint32_t)clr.g << 8) | clr.b;
+    // the log window scrolls to the new line on the next frame
+    if (demo_log_pending()) { invalidate(1); }
+    return res & MU_RES_CHANGE;
 }
 
 static void render_bg(struct fenster *window) {
@@ -269,7 +102,7 @@ static void render_bg(struct fenster *window) {
 
     int w2 = window->width / 2;
     int h2 = window->height / 2;
-    float theta = 3.14159f / 240.0;
+    float theta = idle ? 0 : 3.14159f / 240.0; // the animation would keep idle mode busy
     float cost = cos(theta);
     float sint = sin(theta);
     int offx = 180;
@@ -325,19 +158,28 @@ static void render_bg(struct fenster *window) {
 int main(int argc, char **argv) {
     fenster_sleep(1000); // prevent stupid xcode from launching app twice.
 
-    struct fenster window = {.title = "Full of beans: Hello World!", .width = 800, .height = 600};
-    window.buf = calloc(window.width * window.height, sizeof(uint32_t));
-    r_init((r_renderbuffer){.data = window.buf, .width = window.width, .height = window.height});
+    int threads = 1;
+    int fps = 60;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--idle")) {
+            idle = true;
+        }
+    }
 
+    // fenster allocates the buffer so that on X11 it can live in shared memory
+    struct fenster window = {.title = "Full of beans: Hello World!", .width = 800, .height = 600};
     fenster_open(&window);
+    r_init((r_renderbuffer){.data = window.buf, .width = window.width, .height = window.height}, threads);
 
     /* init microui */
     mu_Context *ctx = malloc(sizeof(mu_Context));
-    mu_init(ctx);
-    ctx->text_width = text_width;
-    ctx->text_height = text_height;
+    demo_init(ctx);
 
-    int fps = 60;
+    pacer_init(&frame_pacer, fps);
     bool mouse_pressed = false;
 
     enum key_state {
@@ -353,10 +195,35 @@ int main(int argc, char **argv) {
         MOD_META  = 1 << 3
     };
 
+    int64_t next_timer = fenster_time() + IDLE_TIMER_MS;
+
     /* main loop */
     while (true) {
         fenster_loop(&window); // swaps buffers too... maybe move after present()? also is not draining queued up events?
 
+        if (idle) {
+            // the last frame is on screen now; sleep until input, the timer or an invalidate.
+            // fenster_fd() gives the same wakeups to an outside poll/epoll loop.
+            fenster_damage(&window, NULL, 0);
+            int64_t now = fenster_time();
+            if (frames_wanted == 0 && now < next_timer) {
+                if (fenster_wait(&window, (int)(next_timer - now))) {
+                    fenster_loop(&window);
+                    fenster_damage(&window, NULL, 0);
+                    // microui reacts to some input (hover, focus) one frame late
+                    invalidate(2);
+                }
+            }
+            if (fenster_time() >= next_timer) {
+                next_timer = fenster_time() + IDLE_TIMER_MS;
+                invalidate(1);
+            }
+            if (frames_wanted == 0) {
+                continue;
+            }
+            frames_wanted--;
+        }
+
         // mouse motion
         mu_input_mousemove(ctx, window.x, window.y);
         
@@ -439,35 +306,42 @@ int main(int argc, char **argv) {
             window.keys[i] = KEY_CONSUMED;
         }
 
-        int64_t before = fenster_time();
+        int64_t before = pacer_now();
 
         /* process frame */
-        process_frame(ctx);
+        bool changed = process_frame(ctx);
+
+        // the background only stands still in idle mode, and then the same
+        // commands make the same pixels: keep the last frame as it is
+        if (idle && !changed) {
+            fenster_damage(&window, NULL, 0);
+            continue;
+        }
 
         /* render */
-        r_clear(mu_color(bg[0], bg[1], bg[2], 255));
+        r_clear(demo_bg());
 
         render_bg(&window);
 
-        mu_Command *cmd = NULL;
-        while (mu_next_command(ctx, &cmd)) {
-            switch (cmd->type) {
-                case MU_COMMAND_TEXT: r_draw_text(cmd->text.str, cmd->text.pos, cmd->text.color); break;
-                case MU_COMMAND_RECT: r_draw_rect(cmd->rect.rect, cmd->rect.color); break;
-                case MU_COMMAND_ICON: r_draw_icon(cmd->icon.id, cmd->icon.rect, cmd->icon.color); break;
-                case MU_COMMAND_CLIP: r_set_clip_rect(cmd->clip.rect); break;
-            }
-        }
+        demo_render(ctx);
         r_present();
 
-        int64_t after = fenster_time();
-        paint_time_ms = after - before;
-        frame_budget_ms = 1000 / fps;
-        sleep_time_ms = frame_budget_ms - paint_time_ms;
-        if (sleep_time_ms > 0) {
-            fenster_sleep(sleep_time_ms);
+        // upload only what changed on the next fenster_loop()
+        const mu_Rect *damage;
+        int damage_len = r_get_damage(&damage);
+        fenster_damage(&window, NULL, 0);
+        for (int i = 0; i < damage_len; i++) {
+            struct fenster_rect r = {damage[i].x, damage[i].y, damage[i].w, damage[i].h};
+            fenster_damage(&window, &r, 1);
+        }
+
+        paint_time_ns = pacer_now() - before;
+        if (!idle) {
+            pacer_wait(&frame_pacer);
         }
     }
+    mu_free(ctx);
+    free(ctx);
     fenster_close(&window);
 
     return 0;
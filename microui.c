@@ -29,6 +29,8 @@
 
 #define unused(x) ((void) (x))
 
+#define HASH_INITIAL 2166136261
+
 #define expect(x) do {                                               \
     if (!(x)) {                                                      \
       fprintf(stderr, "Fatal error: %s:%d: assertion '%s' failed\n", \
@@ -37,10 +39,12 @@
     }                                                                \
   } while (0)
 
-#define push(stk, val) do {                                                 \
-    expect((stk).idx < (int) (sizeof((stk).items) / sizeof(*(stk).items))); \
-    (stk).items[(stk).idx] = (val);                                         \
-    (stk).idx++; /* incremented after incase `val` uses this value */       \
+#define push(ctx, stk, val) do {                                              \
+    if ((stk).idx == (stk).cap) {                                             \
+      grow(ctx, (void**) &(stk).items, &(stk).cap, sizeof(*(stk).items), 16); \
+    }                                                                         \
+    (stk).items[(stk).idx] = (val);                                           \
+    (stk).idx++; /* incremented after incase `val` uses this value */         \
   } while (0)
 
 #define pop(stk) do {      \
@@ -49,6 +53,34 @@
   } while (0)
 
 
+struct mu_CommandChunk {
+  mu_CommandChunk *next;
+  int size;
+  alignas(max_align_t) char data[];
+};
+
+
+static void* default_realloc(void *udata, void *ptr, size_t old_size, size_t new_size) {
+  unused(udata); unused(old_size);
+  if (new_size == 0) { free(ptr); return NULL; }
+  return realloc(ptr, new_size);
+}
+
+
+static void* mu_realloc(mu_Context *ctx, void *ptr, size_t old_size, size_t new_size) {
+  void *res = ctx->allocator.realloc(ctx->allocator.udata, ptr, old_size, new_size);
+  expect(res || new_size == 0);
+  return res;
+}
+
+
+static void grow(mu_Context *ctx, void **items, int *cap, size_t size, int initial) {
+  int n = *cap ? *cap * 2 : initial;
+  *items = mu_realloc(ctx, *items, *cap * size, n * size);
+  *cap = n;
+}
+
+
 static mu_Rect unclipped_rect = { 0, 0, 0x1000000, 0x1000000 };
 
 static mu_Style default_style = {
@@ -129,34 +161,97 @@ static void draw_frame(mu_Context *ctx, mu_Rect rect, int colorid) {
 }
 
 
-void mu_init(mu_Context *ctx) {
+static mu_CommandChunk* new_chunk(mu_Context *ctx, int size) {
+  mu_CommandChunk *chunk = mu_realloc(ctx, NULL, 0, sizeof(mu_CommandChunk) + size);
+  chunk->next = NULL;
+  chunk->size = size;
+  return chunk;
+}
+
+
+static void free_chunks(mu_Context *ctx, mu_CommandChunk *chunk) {
+  while (chunk) {
+    mu_CommandChunk *next = chunk->next;
+    mu_realloc(ctx, chunk, sizeof(mu_CommandChunk) + chunk->size, 0);
+    chunk = next;
+  }
+}
+
+
+static void pool_setup(mu_Context *ctx, mu_Pool *pool, int len);
+static void pool_free(mu_Context *ctx, mu_Pool *pool);
+static mu_Container* container_at(mu_Context *ctx, int idx);
+static void reserve_containers(mu_Context *ctx);
+
+void mu_init(mu_Context *ctx, const mu_Allocator *allocator) {
+  static const mu_Allocator default_allocator = { default_realloc, NULL };
   memset(ctx, 0, sizeof(*ctx));
   ctx->draw_frame = draw_frame;
   ctx->_style = default_style;
   ctx->style = &ctx->_style;
+  ctx->allocator = allocator ? *allocator : default_allocator;
+  ctx->chunks = ctx->chunk = new_chunk(ctx, MU_COMMANDLIST_SIZE);
+  grow(ctx, (void**) &ctx->root_list.items, &ctx->root_list.cap, sizeof(mu_Container*), MU_ROOTLIST_SIZE);
+  grow(ctx, (void**) &ctx->container_stack.items, &ctx->container_stack.cap, sizeof(mu_Container*), MU_CONTAINERSTACK_SIZE);
+  grow(ctx, (void**) &ctx->clip_stack.items, &ctx->clip_stack.cap, sizeof(mu_Rect), MU_CLIPSTACK_SIZE);
+  grow(ctx, (void**) &ctx->id_stack.items, &ctx->id_stack.cap, sizeof(mu_Id), MU_IDSTACK_SIZE);
+  grow(ctx, (void**) &ctx->layout_stack.items, &ctx->layout_stack.cap, sizeof(mu_Layout), MU_LAYOUTSTACK_SIZE);
+  pool_setup(ctx, &ctx->container_pool, MU_CONTAINERPOOL_SIZE);
+  reserve_containers(ctx);
+  pool_setup(ctx, &ctx->treenode_pool, MU_TREENODEPOOL_SIZE);
+}
+
+
+void mu_free(mu_Context *ctx) {
+  int i;
+  for (i = 0; i < ctx->container_pool.len; i++) {
+    mu_Retained *r = &container_at(ctx, i)->retained;
+    mu_realloc(ctx, r->commands, r->cap, 0);
+    mu_realloc(ctx, r->refs, r->ref_cap * sizeof(mu_PoolRef), 0);
+  }
+  for (i = 0; i < ctx->container_page_count; i++) {
+    mu_realloc(ctx, ctx->container_pages[i], MU_CONTAINERPAGE_SIZE * sizeof(mu_Container), 0);
+  }
+  mu_realloc(ctx, ctx->container_pages, ctx->container_page_count * sizeof(mu_Container*), 0);
+  pool_free(ctx, &ctx->container_pool);
+  pool_free(ctx, &ctx->treenode_pool);
+  for (i = 0; i < MU_TEXTLINES_CACHE_SIZE; i++) {
+    mu_realloc(ctx, ctx->text_lines[i].ends, ctx->text_lines[i].cap * sizeof(int), 0);
+    mu_realloc(ctx, ctx->text_lines[i].text, ctx->text_lines[i].text_cap, 0);
+  }
+  free_chunks(ctx, ctx->chunks);
+  mu_realloc(ctx, ctx->root_list.items, ctx->root_list.cap * sizeof(mu_Container*), 0);
+  mu_realloc(ctx, ctx->container_stack.items, ctx->container_stack.cap * sizeof(mu_Container*), 0);
+  mu_realloc(ctx, ctx->clip_stack.items, ctx->clip_stack.cap * sizeof(mu_Rect), 0);
+  mu_realloc(ctx, ctx->id_stack.items, ctx->id_stack.cap * sizeof(mu_Id), 0);
+  mu_realloc(ctx, ctx->layout_stack.items, ctx->layout_stack.cap * sizeof(mu_Layout), 0);
+  memset(ctx, 0, sizeof(*ctx));
 }
 
 
 void mu_begin(mu_Context *ctx) {
   expect(ctx->text_width && ctx->text_height);
-  ctx->command_list.idx = 0;
+  ctx->chunk = ctx->chunks;
+  ctx->chunk_idx = 0;
   ctx->root_list.idx = 0;
   ctx->scroll_target = NULL;
   ctx->hover_root = ctx->next_hover_root;
   ctx->next_hover_root = NULL;
   ctx->mouse_delta.x = ctx->mouse_pos.x - ctx->last_mouse_pos.x;
   ctx->mouse_delta.y = ctx->mouse_pos.y - ctx->last_mouse_pos.y;
+  ctx->frame_hash = HASH_INITIAL;
+  ctx->hash_pending = NULL;
   ctx->frame++;
 }
 
 
-static int compare_zindex(const void *a, const void *b) {
-  return (*(mu_Container**) a)->zindex - (*(mu_Container**) b)->zindex;
-}
+static int end_frame_hash(mu_Context *ctx);
 
 
-void mu_end(mu_Context *ctx) {
-  int i, n;
+int mu_end(mu_Context *ctx) {
+  mu_Container *cnt;
+  mu_CommandChunk *chunk;
+  int i, n, res, used;
   /* check stacks */
   expect(ctx->container_stack.idx == 0);
   expect(ctx->clip_stack.idx      == 0);
@@ -188,17 +283,23 @@ void mu_end(mu_Context *ctx) {
   ctx->scroll_delta = mu_vec2(0, 0);
   ctx->last_mouse_pos = ctx->mouse_pos;
 
-  /* sort root containers by zindex */
-  n = ctx->root_list.idx;
-  qsort(ctx->root_list.items, n, sizeof(mu_Container*), compare_zindex);
+  /* put root containers in zindex order: the ones begun this frame, as they
+  ** come in the z-order list */
+  n = 0;
+  for (cnt = ctx->z_bottom; cnt; cnt = cnt->above) {
+    if (cnt->root_frame == ctx->frame) { ctx->root_list.items[n++] = cnt; }
+  }
+  expect(n == ctx->root_list.idx);
+  /* the draw order is known now, so the frame can be told apart from the last */
+  res = end_frame_hash(ctx);
 
   /* set root container jump commands */
   for (i = 0; i < n; i++) {
-    mu_Container *cnt = ctx->root_list.items[i];
+    cnt = ctx->root_list.items[i];
     /* if this is the first container then make the first command jump to it.
     ** otherwise set the previous container's tail to jump to this one */
     if (i == 0) {
-      mu_Command *cmd = (mu_Command*) ctx->command_list.items;
+      mu_Command *cmd = (mu_Command*) ctx->chunks->data;
       cmd->jump.dst = (char*) cnt->head + sizeof(mu_JumpCommand);
     } else {
       mu_Container *prev = ctx->root_list.items[i - 1];
@@ -206,9 +307,23 @@ void mu_end(mu_Context *ctx) {
     }
     /* make the last container's tail jump to the end of command list */
     if (i == n - 1) {
-      cnt->tail->jump.dst = ctx->command_list.items + ctx->command_list.idx;
+      cnt->tail->jump.dst = ctx->chunk->data + ctx->chunk_idx;
     }
   }
+
+  /* keep the chunks this frame did not need for the next ones, unless no
+  ** frame has needed them for a while */
+  for (used = 1, chunk = ctx->chunks; chunk != ctx->chunk; chunk = chunk->next) { used++; }
+  if (used >= ctx->chunk_peak) {
+    ctx->chunk_peak = used;
+    ctx->chunk_quiet = 0;
+  } else if (++ctx->chunk_quiet >= MU_COMMANDTRIM_FRAMES) {
+    free_chunks(ctx, ctx->chunk->next);
+    ctx->chunk->next = NULL;
+    ctx->chunk_peak = used;
+    ctx->chunk_quiet = 0;
+  }
+  return res;
 }
 
 
@@ -218,9 +333,7 @@ void mu_set_focus(mu_Context *ctx, mu_Id id) {
 }
 
 
-/* 32bit fnv-1a hash */
-#define HASH_INITIAL 2166136261
-
+/* 32bit fnv-1a hash, starting from HASH_INITIAL */
 static void hash(mu_Id *hash, const void *data, int size) {
   const unsigned char *p = data;
   while (size--) {
@@ -228,6 +341,51 @@ static void hash(mu_Id *hash, const void *data, int size) {
   }
 }
 
+/* a word at a time, for the frame hash which sees every command */
+static void hash_words(mu_Id *res, const void *data, int size) {
+  const unsigned char *p = data;
+  unsigned w;
+  for (; size >= (int) sizeof(w); size -= sizeof(w), p += sizeof(w)) {
+    memcpy(&w, p, sizeof(w));
+    *res = (*res ^ w) * 16777619;
+  }
+  for (; size > 0; size--) {
+    *res = (*res ^ *p++) * 16777619;
+  }
+}
+
+
+/* ctx->text_width() through a small cache. entries are found by font, length and
+** a hash of the string, and keep a copy of it so a colliding string can't take
+** another's width; a miss replaces the least recently used way of its set */
+static int text_width(mu_Context *ctx, mu_Font font, const char *str, int len) {
+  mu_TextWidth *set, *victim;
+  mu_Id h = HASH_INITIAL;
+  int i;
+  if (len < 0) { len = strlen(str); }
+  /* single characters cost less to measure than to look up, and longer
+  ** strings than the key hold are not cached */
+  if (len <= 1 || len > MU_TEXTWIDTH_KEY_SIZE) { return ctx->text_width(font, str, len); }
+  hash_words(&h, str, len);
+  set = &ctx->text_widths[h & (MU_TEXTWIDTH_CACHE_SIZE - 4)];
+  victim = set;
+  for (i = 0; i < 4; i++) {
+    if (set[i].hash == h && set[i].len == len && set[i].font == font &&
+        !memcmp(set[i].text, str, len)) {
+      set[i].last_update = ctx->frame;
+      return set[i].width;
+    }
+    if (set[i].last_update < victim->last_update) { victim = &set[i]; }
+  }
+  victim->font = font;
+  victim->hash = h;
+  victim->len = len;
+  memcpy(victim->text, str, len);
+  victim->width = ctx->text_width(font, str, len);
+  victim->last_update = ctx->frame;
+  return victim->width;
+}
+
 
 mu_Id mu_get_id(mu_Context *ctx, const void *data, int size) {
   int idx = ctx->id_stack.idx;
@@ -239,7 +397,7 @@ mu_Id mu_get_id(mu_Context *ctx, const void *data, int size) {
 
 
 void mu_push_id(mu_Context *ctx, const void *data, int size) {
-  push(ctx->id_stack, mu_get_id(ctx, data, size));
+  push(ctx, ctx->id_stack, mu_get_id(ctx, data, size));
 }
 
 
@@ -250,7 +408,7 @@ void mu_pop_id(mu_Context *ctx) {
 
 void mu_push_clip_rect(mu_Context *ctx, mu_Rect rect) {
   mu_Rect last = mu_get_clip_rect(ctx);
-  push(ctx->clip_stack, intersect_rects(rect, last));
+  push(ctx, ctx->clip_stack, intersect_rects(rect, last));
 }
 
 
@@ -281,7 +439,7 @@ static void push_layout(mu_Context *ctx, mu_Rect body, mu_Vec2 scroll) {
   memset(&layout, 0, sizeof(layout));
   layout.body = mu_rect(body.x - scroll.x, body.y - scroll.y, body.w, body.h);
   layout.max = mu_vec2(-0x1000000, -0x1000000);
-  push(ctx->layout_stack, layout);
+  push(ctx, ctx->layout_stack, layout);
   mu_layout_row(ctx, 1, &width, 0);
 }
 
@@ -309,20 +467,69 @@ mu_Container* mu_get_current_container(mu_Context *ctx) {
 }
 
 
+static void unlink_zorder(mu_Context *ctx, mu_Container *cnt) {
+  if (cnt->below) { cnt->below->above = cnt->above; }
+  else if (ctx->z_bottom == cnt) { ctx->z_bottom = cnt->above; }
+  if (cnt->above) { cnt->above->below = cnt->below; }
+  else if (ctx->z_top == cnt) { ctx->z_top = cnt->below; }
+  cnt->below = cnt->above = NULL;
+}
+
+
+static mu_Container* container_at(mu_Context *ctx, int idx) {
+  return &ctx->container_pages[idx / MU_CONTAINERPAGE_SIZE][idx % MU_CONTAINERPAGE_SIZE];
+}
+
+
+/* adds pages until every item of the container pool has its container */
+static void reserve_containers(mu_Context *ctx) {
+  while (ctx->container_page_count * MU_CONTAINERPAGE_SIZE < ctx->container_pool.len) {
+    int n = ctx->container_page_count;
+    mu_Container *page = mu_realloc(ctx, NULL, 0, MU_CONTAINERPAGE_SIZE * sizeof(mu_Container));
+    memset(page, 0, MU_CONTAINERPAGE_SIZE * sizeof(mu_Container));
+    ctx->container_pages = mu_realloc(ctx, ctx->container_pages,
+      n * sizeof(mu_Container*), (n + 1) * sizeof(mu_Container*));
+    ctx->container_pages[n] = page;
+    ctx->container_page_count++;
+  }
+}
+
+
+/* notes a pool entry used by the retained window being built, so that its
+** replays can keep the entry from being evicted */
+static void retain_pool_ref(mu_Context *ctx, mu_Pool *pool, mu_Id id) {
+  mu_Retained *r;
+  if (!ctx->recording) { return; }
+  r = &ctx->recording->retained;
+  if (r->ref_count == r->ref_cap) {
+    grow(ctx, (void**) &r->refs, &r->ref_cap, sizeof(mu_PoolRef), 16);
+  }
+  r->refs[r->ref_count].pool = pool;
+  r->refs[r->ref_count].id = id;
+  r->ref_count++;
+}
+
+
 static mu_Container* get_container(mu_Context *ctx, mu_Id id, int opt) {
   mu_Container *cnt;
   /* try to get existing container from pool */
-  int idx = mu_pool_get(ctx, ctx->container_pool, MU_CONTAINERPOOL_SIZE, id);
+  int idx = mu_pool_get(ctx, &ctx->container_pool, id);
   if (idx >= 0) {
-    if (ctx->containers[idx].open || ~opt & MU_OPT_CLOSED) {
-      mu_pool_update(ctx, ctx->container_pool, idx);
+    if (container_at(ctx, idx)->open || ~opt & MU_OPT_CLOSED) {
+      mu_pool_update(ctx, &ctx->container_pool, idx);
+      retain_pool_ref(ctx, &ctx->container_pool, id);
     }
-    return &ctx->containers[idx];
+    return container_at(ctx, idx);
   }
   if (opt & MU_OPT_CLOSED) { return NULL; }
   /* container not found in pool: init new container */
-  idx = mu_pool_init(ctx, ctx->container_pool, MU_CONTAINERPOOL_SIZE, id);
-  cnt = &ctx->containers[idx];
+  idx = mu_pool_init(ctx, &ctx->container_pool, id);
+  retain_pool_ref(ctx, &ctx->container_pool, id);
+  reserve_containers(ctx);
+  cnt = container_at(ctx, idx);
+  mu_realloc(ctx, cnt->retained.commands, cnt->retained.cap, 0);
+  mu_realloc(ctx, cnt->retained.refs, cnt->retained.ref_cap * sizeof(mu_PoolRef), 0);
+  unlink_zorder(ctx, cnt);
   memset(cnt, 0, sizeof(*cnt));
   cnt->open = 1;
   mu_bring_to_front(ctx, cnt);
@@ -336,42 +543,152 @@ mu_Container* mu_get_container(mu_Context *ctx, const char *name) {
 }
 
 
+/* containers are kept in a list ordered by zindex, so mu_end() can put the
+** roots in order without sorting them */
 void mu_bring_to_front(mu_Context *ctx, mu_Container *cnt) {
   cnt->zindex = ++ctx->last_zindex;
+  if (ctx->z_top == cnt) { return; }
+  unlink_zorder(ctx, cnt);
+  cnt->below = ctx->z_top;
+  if (ctx->z_top) { ctx->z_top->above = cnt; } else { ctx->z_bottom = cnt; }
+  ctx->z_top = cnt;
 }
 
 
 /*============================================================================
 ** pool
+**
+** items are found through a hash index over their ids and kept on a list
+** ordered by last use, so lookups and picking the item to evict cost the
+** same however large the pool is.
 **============================================================================*/
 
-int mu_pool_init(mu_Context *ctx, mu_PoolItem *items, int len, mu_Id id) {
-  int i, n = -1, f = ctx->frame;
-  for (i = 0; i < len; i++) {
-    if (items[i].last_update < f) {
-      f = items[i].last_update;
-      n = i;
+static void pool_unlink(mu_Pool *pool, int idx) {
+  mu_PoolItem *item = &pool->items[idx];
+  if (item->prev >= 0) { pool->items[item->prev].next = item->next; }
+                  else { pool->head = item->next; }
+  if (item->next >= 0) { pool->items[item->next].prev = item->prev; }
+                  else { pool->tail = item->prev; }
+}
+
+
+static void pool_link(mu_Pool *pool, int idx, int at_head) {
+  mu_PoolItem *item = &pool->items[idx];
+  if (at_head) {
+    item->prev = -1;
+    item->next = pool->head;
+    if (pool->head >= 0) { pool->items[pool->head].prev = idx; }
+    pool->head = idx;
+    if (pool->tail < 0) { pool->tail = idx; }
+  } else {
+    item->next = -1;
+    item->prev = pool->tail;
+    if (pool->tail >= 0) { pool->items[pool->tail].next = idx; }
+    pool->tail = idx;
+    if (pool->head < 0) { pool->head = idx; }
+  }
+}
+
+
+static void pool_index(mu_Pool *pool, int idx) {
+  int i = pool->items[idx].id % pool->slot_count;
+  while (pool->slots[i]) { i = (i + 1) % pool->slot_count; }
+  pool->slots[i] = idx + 1;
+}
+
+
+/* adds len unused items, last in line, and rebuilds the index for the new size */
+static void pool_grow(mu_Context *ctx, mu_Pool *pool, int len) {
+  int i, old = pool->len;
+  pool->items = mu_realloc(ctx, pool->items,
+    old * sizeof(mu_PoolItem), (old + len) * sizeof(mu_PoolItem));
+  memset(pool->items + old, 0, len * sizeof(mu_PoolItem));
+  pool->len = old + len;
+  for (i = old; i < pool->len; i++) { pool_link(pool, i, 0); }
+
+  mu_realloc(ctx, pool->slots, pool->slot_count * sizeof(int), 0);
+  pool->slot_count = pool->len * 2;
+  pool->slots = mu_realloc(ctx, NULL, 0, pool->slot_count * sizeof(int));
+  memset(pool->slots, 0, pool->slot_count * sizeof(int));
+  for (i = 0; i < pool->len; i++) {
+    if (pool->items[i].id) { pool_index(pool, i); }
+  }
+}
+
+
+static void pool_setup(mu_Context *ctx, mu_Pool *pool, int len) {
+  memset(pool, 0, sizeof(*pool));
+  pool->head = pool->tail = -1;
+  pool_grow(ctx, pool, mu_max(len, 1));
+}
+
+
+static void pool_free(mu_Context *ctx, mu_Pool *pool) {
+  mu_realloc(ctx, pool->items, pool->len * sizeof(mu_PoolItem), 0);
+  mu_realloc(ctx, pool->slots, pool->slot_count * sizeof(int), 0);
+}
+
+
+static void pool_unindex(mu_Pool *pool, int idx) {
+  int n = pool->slot_count;
+  int i = pool->items[idx].id % n, j;
+  while (pool->slots[i] && pool->slots[i] != idx + 1) { i = (i + 1) % n; }
+  if (!pool->slots[i]) { return; } /* was never indexed */
+  /* shift the rest of the probe run back so no lookup hits the gap early */
+  for (j = (i + 1) % n; pool->slots[j]; j = (j + 1) % n) {
+    int home = pool->items[pool->slots[j] - 1].id % n;
+    int stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (!stays) {
+      pool->slots[i] = pool->slots[j];
+      i = j;
     }
   }
-  expect(n > -1);
-  items[n].id = id;
-  mu_pool_update(ctx, items, n);
+  pool->slots[i] = 0;
+}
+
+
+int mu_pool_init(mu_Context *ctx, mu_Pool *pool, mu_Id id) {
+  int n = pool->tail;
+  /* every item is in use this frame: grow rather than evict one */
+  if (n < 0 || pool->items[n].last_update >= ctx->frame) {
+    pool_grow(ctx, pool, mu_max(pool->len, 16));
+    n = pool->tail;
+  }
+  pool_unindex(pool, n);
+  pool->items[n].id = id;
+  pool_index(pool, n);
+  mu_pool_update(ctx, pool, n);
   return n;
 }
 
 
-int mu_pool_get(mu_Context *ctx, mu_PoolItem *items, int len, mu_Id id) {
-  int i;
+int mu_pool_get(mu_Context *ctx, mu_Pool *pool, mu_Id id) {
+  int i = id % pool->slot_count;
   unused(ctx);
-  for (i = 0; i < len; i++) {
-    if (items[i].id == id) { return i; }
+  while (pool->slots[i]) {
+    int idx = pool->slots[i] - 1;
+    if (pool->items[idx].id == id) { return idx; }
+    i = (i + 1) % pool->slot_count;
   }
   return -1;
 }
 
 
-void mu_pool_update(mu_Context *ctx, mu_PoolItem *items, int idx) {
-  items[idx].last_update = ctx->frame;
+void mu_pool_update(mu_Context *ctx, mu_Pool *pool, int idx) {
+  pool->items[idx].last_update = ctx->frame;
+  pool_unlink(pool, idx);
+  pool_link(pool, idx, 1);
+}
+
+
+void mu_pool_remove(mu_Context *ctx, mu_Pool *pool, int idx) {
+  unused(ctx);
+  pool_unindex(pool, idx);
+  pool->items[idx].id = 0;
+  pool->items[idx].last_update = 0;
+  /* first in line for reuse */
+  pool_unlink(pool, idx);
+  pool_link(pool, idx, 0);
 }
 
 
@@ -426,26 +743,85 @@ void mu_input_text(mu_Context *ctx, const char *text) {
 ** commandlist
 **============================================================================*/
 
+#define align_command(size) \
+  (((size) + (int) alignof(max_align_t) - 1) & ~((int) alignof(max_align_t) - 1))
+
+
+/* folds the previously pushed command into the frame hash. commands are filled
+** in after mu_push_command() returns, so each one waits for the next push (or
+** the end of the frame). padding is left out as it is never written */
+static void hash_command(mu_Context *ctx) {
+  mu_Command *cmd = ctx->hash_pending;
+  mu_Id *h = &ctx->frame_hash;
+  if (!cmd) { return; }
+  ctx->hash_pending = NULL;
+  switch (cmd->type) {
+    /* root jump targets are only set in mu_end(); the root order is hashed there */
+    case MU_COMMAND_JUMP: hash_words(h, &cmd->type, sizeof(int)); break;
+    case MU_COMMAND_CLIP: hash_words(h, cmd, sizeof(mu_ClipCommand)); break;
+    case MU_COMMAND_RECT: hash_words(h, cmd, sizeof(mu_RectCommand)); break;
+    case MU_COMMAND_ICON: hash_words(h, cmd, sizeof(mu_IconCommand)); break;
+    case MU_COMMAND_TEXT:
+      hash_words(h, cmd, offsetof(mu_TextCommand, str));
+      hash_words(h, cmd->text.str, strlen(cmd->text.str));
+      break;
+    default: hash_words(h, cmd, cmd->base.size); break;
+  }
+}
+
+
+static int end_frame_hash(mu_Context *ctx) {
+  int i, res;
+  hash_command(ctx);
+  for (i = 0; i < ctx->root_list.idx; i++) {
+    hash_words(&ctx->frame_hash, &ctx->root_list.items[i], sizeof(mu_Container*));
+  }
+  res = ctx->frame_hash != ctx->last_frame_hash ? MU_RES_CHANGE : 0;
+  ctx->last_frame_hash = ctx->frame_hash;
+  return res;
+}
+
+
 mu_Command* mu_push_command(mu_Context *ctx, int type, int size) {
-  int alignment = alignof(max_align_t) - 1;
-  size = (size + alignment) & ~alignment;
-    
-  mu_Command *cmd = (mu_Command*) (ctx->command_list.items + ctx->command_list.idx);
-  expect(ctx->command_list.idx + size < MU_COMMANDLIST_SIZE);
+  mu_Command *cmd;
+  int jump_size = align_command((int) sizeof(mu_JumpCommand));
+  size = align_command(size);
+  hash_command(ctx);
+
+  /* out of room: continue in the next chunk, always leaving space for the
+  ** jump that leads there */
+  if (ctx->chunk_idx + size + jump_size > ctx->chunk->size) {
+    mu_CommandChunk *next = ctx->chunk->next;
+    if (!next || next->size < size + jump_size) {
+      next = new_chunk(ctx, mu_max(MU_COMMANDLIST_SIZE, size + jump_size));
+      next->next = ctx->chunk->next;
+      ctx->chunk->next = next;
+    }
+    cmd = (mu_Command*) (ctx->chunk->data + ctx->chunk_idx);
+    cmd->base.type = MU_COMMAND_JUMP;
+    cmd->base.size = jump_size;
+    cmd->jump.dst = next->data;
+    ctx->chunk = next;
+    ctx->chunk_idx = 0;
+  }
+
+  cmd = (mu_Command*) (ctx->chunk->data + ctx->chunk_idx);
   cmd->base.type = type;
   cmd->base.size = size;
-  ctx->command_list.idx += size;
+  ctx->chunk_idx += size;
+  ctx->hash_pending = cmd;
   return cmd;
 }
 
 
 int mu_next_command(mu_Context *ctx, mu_Command **cmd) {
+  char *end = ctx->chunk->data + ctx->chunk_idx;
   if (*cmd) {
     *cmd = (mu_Command*) (((char*) *cmd) + (*cmd)->base.size);
   } else {
-    *cmd = (mu_Command*) ctx->command_list.items;
+    *cmd = (mu_Command*) ctx->chunks->data;
   }
-  while ((char*) *cmd != ctx->command_list.items + ctx->command_list.idx) {
+  while ((char*) *cmd != end) {
     if ((*cmd)->type != MU_COMMAND_JUMP) { return 1; }
     *cmd = (*cmd)->jump.dst;
   }
@@ -492,7 +868,7 @@ void mu_draw_text(mu_Context *ctx, mu_Font font, const char *str, int len,
 {
   mu_Command *cmd;
   mu_Rect rect = mu_rect(
-    pos.x, pos.y, ctx->text_width(font, str, len), ctx->text_height(font));
+    pos.x, pos.y, text_width(ctx, font, str, len), ctx->text_height(font));
   int clipped = mu_check_clip(ctx, rect);
   if (clipped == MU_CLIP_ALL ) { return; }
   if (clipped == MU_CLIP_PART) { mu_set_clip(ctx, mu_get_clip_rect(ctx)); }
@@ -629,19 +1005,51 @@ mu_Rect mu_layout_next(mu_Context *ctx) {
 }
 
 
+/* rows use the current layout row's items and height. the visible ones are
+** found from the clip rect, and the layout skips ahead to the first of them */
+void mu_clipper_begin(mu_Context *ctx, mu_Clipper *clipper, int count) {
+  mu_Layout *layout = get_layout(ctx);
+  mu_Rect clip = mu_get_clip_rect(ctx);
+  int y;
+  /* rows start on a row of their own */
+  if (layout->item_index != 0) {
+    mu_layout_row(ctx, layout->items, NULL, layout->size.y);
+  }
+  clipper->count = count;
+  clipper->top = layout->position.y;
+  clipper->height = layout->size.y ? layout->size.y : ctx->style->size.y + ctx->style->padding * 2;
+  clipper->step = clipper->height + ctx->style->spacing;
+  expect(clipper->height > 0);
+
+  y = layout->body.y + clipper->top;
+  clipper->first = mu_clamp((clip.y - y) / clipper->step, 0, count);
+  clipper->last = mu_clamp((clip.y + clip.h - y) / clipper->step + 1, clipper->first, count);
+
+  layout->next_row = clipper->top + clipper->first * clipper->step;
+  mu_layout_row(ctx, layout->items, NULL, layout->size.y);
+}
+
+
+void mu_clipper_end(mu_Context *ctx, mu_Clipper *clipper) {
+  mu_Layout *layout = get_layout(ctx);
+  if (clipper->count > 0) {
+    int bottom = clipper->top + (clipper->count - 1) * clipper->step + clipper->height;
+    layout->max.y = mu_max(layout->max.y, layout->body.y + bottom);
+  }
+  layout->next_row = clipper->top + clipper->count * clipper->step;
+  mu_layout_row(ctx, layout->items, NULL, layout->size.y);
+}
+
+
 /*============================================================================
 ** controls
 **============================================================================*/
 
 static int in_hover_root(mu_Context *ctx) {
+  /* the hover root is always a root container, and every container knows the
+  ** root it was begun in */
   int i = ctx->container_stack.idx;
-  while (i--) {
-    if (ctx->container_stack.items[i] == ctx->hover_root) { return 1; }
-    /* only root containers have their `head` field set; stop searching if we've
-    ** reached the current root container */
-    if (ctx->container_stack.items[i]->head) { break; }
-  }
-  return 0;
+  return i > 0 && ctx->container_stack.items[i - 1]->root == ctx->hover_root;
 }
 
 
@@ -659,7 +1067,7 @@ void mu_draw_control_text(mu_Context *ctx, const char *str, mu_Rect rect,
 {
   mu_Vec2 pos;
   mu_Font font = ctx->style->font;
-  int tw = ctx->text_width(font, str, -1);
+  int tw = text_width(ctx, font, str, -1);
   mu_push_clip_rect(ctx, rect);
   pos.y = rect.y + (rect.h - ctx->text_height(font)) / 2;
   if (opt & MU_OPT_ALIGNCENTER) {
@@ -703,28 +1111,84 @@ void mu_update_control(mu_Context *ctx, mu_Id id, mu_Rect rect, int opt) {
 }
 
 
-void mu_text(mu_Context *ctx, const char *text) {
+/* breaks text into lines no wider than width, or finds the lines from the last
+** time the same text was broken for the same width and font. entries keep a
+** copy of the text: lines found for other text could run past this one's end */
+static mu_TextLines* wrap_text(mu_Context *ctx, mu_Font font, const char *text, int width) {
+  mu_TextLines *lines = ctx->text_lines;
   const char *start, *end, *p = text;
-  int width = -1;
-  mu_Font font = ctx->style->font;
-  mu_Color color = ctx->style->colors[MU_COLOR_TEXT];
-  mu_layout_begin_column(ctx);
-  mu_layout_row(ctx, 1, &width, ctx->text_height(font));
+  int i, len = strlen(text);
+  mu_Id h = HASH_INITIAL;
+  hash_words(&h, text, len);
+  for (i = 0; i < MU_TEXTLINES_CACHE_SIZE; i++) {
+    mu_TextLines *l = &ctx->text_lines[i];
+    if (l->hash == h && l->len == len && l->width == width && l->font == font &&
+        l->count && !memcmp(l->text, text, len)) {
+      l->last_update = ctx->frame;
+      return l;
+    }
+    if (l->last_update < lines->last_update) { lines = l; }
+  }
+
+  lines->font = font;
+  lines->hash = h;
+  lines->len = len;
+  if (len + 1 > lines->text_cap) {
+    lines->text = mu_realloc(ctx, lines->text, lines->text_cap, len + 1);
+    lines->text_cap = len + 1;
+  }
+  memcpy(lines->text, text, len + 1);
+  lines->width = width;
+  lines->count = 0;
+  lines->last_update = ctx->frame;
   do {
-    mu_Rect r = mu_layout_next(ctx);
     int w = 0;
     start = end = p;
     do {
       const char* word = p;
       while (*p && *p != ' ' && *p != '\n') { p++; }
-      w += ctx->text_width(font, word, p - word);
-      if (w > r.w && end != start) { break; }
-      w += ctx->text_width(font, p, 1);
+      w += text_width(ctx, font, word, p - word);
+      if (w > width && end != start) { break; }
+      w += text_width(ctx, font, p, 1);
       end = p++;
     } while (*end && *end != '\n');
-    mu_draw_text(ctx, font, start, end - start, mu_vec2(r.x, r.y), color);
+    if (lines->count == lines->cap) {
+      grow(ctx, (void**) &lines->ends, &lines->cap, sizeof(int), 64);
+    }
+    lines->ends[lines->count++] = end - text;
     p = end + 1;
   } while (*end);
+  return lines;
+}
+
+
+void mu_text(mu_Context *ctx, const char *text) {
+  mu_TextLines *lines;
+  mu_Rect r, clip;
+  int width = -1, step, first, last, i;
+  mu_Font font = ctx->style->font;
+  mu_Color color = ctx->style->colors[MU_COLOR_TEXT];
+  mu_layout_begin_column(ctx);
+  mu_layout_row(ctx, 1, &width, ctx->text_height(font));
+  r = mu_layout_next(ctx);
+  lines = wrap_text(ctx, font, text, r.w);
+  step = r.h + ctx->style->spacing;
+
+  /* only draw the lines that can be seen */
+  clip = mu_get_clip_rect(ctx);
+  first = mu_max(0, (clip.y - r.y) / step);
+  last = mu_min(lines->count - 1, (clip.y + clip.h - r.y) / step);
+  for (i = first; i <= last; i++) {
+    int start = i > 0 ? lines->ends[i - 1] + 1 : 0;
+    mu_draw_text(ctx, font, text + start, lines->ends[i] - start,
+      mu_vec2(r.x, r.y + i * step), color);
+  }
+
+  /* lay out the last line as if all the ones before it had been */
+  if (lines->count > 1) {
+    get_layout(ctx)->next_row += (lines->count - 2) * step;
+    mu_layout_next(ctx);
+  }
   mu_layout_end_column(ctx);
 }
 
@@ -809,7 +1273,7 @@ int mu_textbox_raw(mu_Context *ctx, char *buf, int bufsz, mu_Id id, mu_Rect r,
   if (ctx->focus == id) {
     mu_Color color = ctx->style->colors[MU_COLOR_TEXT];
     mu_Font font = ctx->style->font;
-    int textw = ctx->text_width(font, buf, -1);
+    int textw = text_width(ctx, font, buf, -1);
     int texth = ctx->text_height(font);
     int ofx = r.w - ctx->style->padding - textw - 1;
     int textx = r.x + mu_min(ofx, ctx->style->padding);
@@ -932,7 +1396,7 @@ static int header(mu_Context *ctx, const char *label, int istreenode, int opt) {
   mu_Rect r;
   int active, expanded;
   mu_Id id = mu_get_id(ctx, label, strlen(label));
-  int idx = mu_pool_get(ctx, ctx->treenode_pool, MU_TREENODEPOOL_SIZE, id);
+  int idx = mu_pool_get(ctx, &ctx->treenode_pool, id);
   int width = -1;
   mu_layout_row(ctx, 1, &width, 0);
 
@@ -946,11 +1410,12 @@ static int header(mu_Context *ctx, const char *label, int istreenode, int opt) {
 
   /* update pool ref */
   if (idx >= 0) {
-    if (active) { mu_pool_update(ctx, ctx->treenode_pool, idx); }
-           else { memset(&ctx->treenode_pool[idx], 0, sizeof(mu_PoolItem)); }
+    if (active) { mu_pool_update(ctx, &ctx->treenode_pool, idx); }
+           else { mu_pool_remove(ctx, &ctx->treenode_pool, idx); }
   } else if (active) {
-    mu_pool_init(ctx, ctx->treenode_pool, MU_TREENODEPOOL_SIZE, id);
+    mu_pool_init(ctx, &ctx->treenode_pool, id);
   }
+  if (active) { retain_pool_ref(ctx, &ctx->treenode_pool, id); }
 
   /* draw */
   if (istreenode) {
@@ -978,7 +1443,7 @@ int mu_begin_treenode_ex(mu_Context *ctx, const char *label, int opt) {
   int res = header(ctx, label, 1, opt);
   if (res & MU_RES_ACTIVE) {
     get_layout(ctx)->indent += ctx->style->indent;
-    push(ctx->id_stack, ctx->last_id);
+    push(ctx, ctx->id_stack, ctx->last_id);
   }
   return res;
 }
@@ -1007,7 +1472,7 @@ void mu_end_treenode(mu_Context *ctx) {
       /* handle input */                                                    \
       mu_update_control(ctx, id, base, 0);                                  \
       if (ctx->focus == id && ctx->mouse_down == MU_MOUSE_LEFT) {           \
-        cnt->scroll.y += ctx->mouse_delta.y * cs.y / base.h;                \
+        cnt->scroll.y += (long long) ctx->mouse_delta.y * cs.y / base.h;    \
       }                                                                     \
       /* clamp scroll to limits */                                          \
       cnt->scroll.y = mu_clamp(cnt->scroll.y, 0, maxscroll);                \
@@ -1016,7 +1481,9 @@ void mu_end_treenode(mu_Context *ctx) {
       ctx->draw_frame(ctx, base, MU_COLOR_SCROLLBASE);                      \
       thumb = base;                                                         \
       thumb.h = mu_max(ctx->style->thumb_size, base.h * b->h / cs.y);       \
-      thumb.y += cnt->scroll.y * (base.h - thumb.h) / maxscroll;            \
+      /* long lists overflow an int here */                                 \
+      thumb.y += (long long) cnt->scroll.y * (base.h - thumb.h)             \
+                 / maxscroll;                                               \
       ctx->draw_frame(ctx, thumb, MU_COLOR_SCROLLTHUMB);                    \
                                                                             \
       /* set this as the scroll_target (will get scrolled on mousewheel) */ \
@@ -1055,10 +1522,14 @@ static void push_container_body(
 
 
 static void begin_root_container(mu_Context *ctx, mu_Container *cnt) {
-  push(ctx->container_stack, cnt);
+  push(ctx, ctx->container_stack, cnt);
   /* push container to roots list and push head command */
-  push(ctx->root_list, cnt);
+  push(ctx, ctx->root_list, cnt);
+  cnt->root = cnt;
+  cnt->root_frame = ctx->frame;
   cnt->head = push_jump(ctx, NULL);
+  /* which window the head belongs to, so reordered windows hash differently */
+  hash_words(&ctx->frame_hash, &cnt, sizeof(cnt));
   /* set as hover root if the mouse is overlapping this container and it has a
   ** higher zindex than the current hover root */
   if (rect_overlaps_vec2(cnt->rect, ctx->mouse_pos) &&
@@ -1069,18 +1540,22 @@ static void begin_root_container(mu_Context *ctx, mu_Container *cnt) {
   /* clipping is reset here in case a root-container is made within
   ** another root-containers's begin/end block; this prevents the inner
   ** root-container being clipped to the outer */
-  push(ctx->clip_stack, unclipped_rect);
+  push(ctx, ctx->clip_stack, unclipped_rect);
 }
 
 
-static void end_root_container(mu_Context *ctx) {
+static void close_root_container(mu_Context *ctx, mu_Container *cnt) {
   /* push tail 'goto' jump command and set head 'skip' command. the final steps
   ** on initing these are done in mu_end() */
-  mu_Container *cnt = mu_get_current_container(ctx);
   cnt->tail = push_jump(ctx, NULL);
-  cnt->head->jump.dst = ctx->command_list.items + ctx->command_list.idx;
-  /* pop base clip rect and container */
+  cnt->head->jump.dst = ctx->chunk->data + ctx->chunk_idx;
+  /* pop base clip rect */
   mu_pop_clip_rect(ctx);
+}
+
+
+static void end_root_container(mu_Context *ctx) {
+  close_root_container(ctx, mu_get_current_container(ctx));
   pop_container(ctx);
 }
 
@@ -1090,7 +1565,7 @@ int mu_begin_window_ex(mu_Context *ctx, const char *title, mu_Rect rect, int opt
   mu_Id id = mu_get_id(ctx, title, strlen(title));
   mu_Container *cnt = get_container(ctx, id, opt);
   if (!cnt || !cnt->open) { return 0; }
-  push(ctx->id_stack, id);
+  push(ctx, ctx->id_stack, id);
 
   if (cnt->rect.w == 0) { cnt->rect = rect; }
   begin_root_container(ctx, cnt);
@@ -1164,12 +1639,122 @@ int mu_begin_window_ex(mu_Context *ctx, const char *title, mu_Rect rect, int opt
 }
 
 
+static void record_window(mu_Context *ctx, mu_Container *cnt);
+
 void mu_end_window(mu_Context *ctx) {
+  mu_Container *cnt = mu_get_current_container(ctx);
   mu_pop_clip_rect(ctx);
+  if (cnt->retained.recording) { record_window(ctx, cnt); }
   end_root_container(ctx);
 }
 
 
+/*============================================================================
+** retained windows
+**============================================================================*/
+
+static mu_RetainKey retain_key(mu_Context *ctx, mu_Container *cnt, int opt, unsigned version) {
+  mu_RetainKey key;
+  memset(&key, 0, sizeof(key));
+  key.version = version;
+  key.rect = cnt->rect;
+  key.scroll = cnt->scroll;
+  key.content_size = cnt->content_size;
+  key.opt = opt;
+  key.style = HASH_INITIAL;
+  hash(&key.style, ctx->style, sizeof(*ctx->style));
+  return key;
+}
+
+
+/* copies the window's commands, from its head jump to the current end of the
+** command list, so that later frames can replay them */
+static void record_window(mu_Context *ctx, mu_Container *cnt) {
+  mu_Retained *r = &cnt->retained;
+  char *end = ctx->chunk->data + ctx->chunk_idx;
+  mu_Command *cmd = (mu_Command*) ((char*) cnt->head + cnt->head->base.size);
+  int focused = ctx->updated_focus;
+
+  r->recording = 0;
+  ctx->recording = r->outer;
+  ctx->updated_focus |= r->updated_focus;
+  /* a focused control must keep running, and nested roots have commands of
+  ** their own outside of this range */
+  r->valid = !focused && ctx->root_list.idx == r->roots;
+  if (!r->valid) { return; }
+
+  r->size = 0;
+  while ((char*) cmd != end) {
+    if (cmd->type == MU_COMMAND_JUMP) {
+      /* only chunk links can be in here */
+      cmd = cmd->jump.dst;
+      continue;
+    }
+    if (r->size + cmd->base.size > r->cap) {
+      int n = mu_max(r->cap * 2, r->size + cmd->base.size);
+      r->commands = mu_realloc(ctx, r->commands, r->cap, n);
+      r->cap = n;
+    }
+    memcpy(r->commands + r->size, cmd, cmd->base.size);
+    r->size += cmd->base.size;
+    cmd = (mu_Command*) ((char*) cmd + cmd->base.size);
+  }
+}
+
+
+static void replay_window(mu_Context *ctx, mu_Container *cnt) {
+  mu_Retained *r = &cnt->retained;
+  int i;
+  /* the build's panels and treenodes are not begun while it replays; keep
+  ** them from aging out of their pools, or the next build starts over */
+  for (i = 0; i < r->ref_count; i++) {
+    int idx = mu_pool_get(ctx, r->refs[i].pool, r->refs[i].id);
+    if (idx >= 0) { mu_pool_update(ctx, r->refs[i].pool, idx); }
+  }
+  i = 0;
+  begin_root_container(ctx, cnt);
+  while (i < r->size) {
+    mu_Command *src = (mu_Command*) (r->commands + i);
+    mu_Command *cmd = mu_push_command(ctx, src->type, src->base.size);
+    memcpy(cmd, src, src->base.size);
+    i += src->base.size;
+  }
+  close_root_container(ctx, cnt);
+  pop(ctx->container_stack);
+}
+
+
+int mu_begin_window_retained(mu_Context *ctx, const char *title, mu_Rect rect, int opt, unsigned version) {
+  mu_RetainKey key;
+  mu_Id id = mu_get_id(ctx, title, strlen(title));
+  mu_Container *cnt = get_container(ctx, id, opt);
+  if (!cnt || !cnt->open) { return 0; }
+  if (cnt->rect.w == 0) { cnt->rect = rect; }
+
+  key = retain_key(ctx, cnt, opt, version);
+  if (cnt->retained.valid && !memcmp(&key, &cnt->retained.key, sizeof(key)) &&
+      ~opt & MU_OPT_POPUP && ctx->hover_root != cnt &&
+      !rect_overlaps_vec2(cnt->rect, ctx->mouse_pos)
+  ) {
+    replay_window(ctx, cnt);
+    return 0;
+  }
+
+  if (!mu_begin_window_ex(ctx, title, rect, opt)) { return 0; }
+  cnt->retained.key = key;
+  cnt->retained.valid = 0;
+  cnt->retained.recording = 1;
+  cnt->retained.roots = ctx->root_list.idx;
+  cnt->retained.ref_count = 0;
+  cnt->retained.outer = ctx->recording;
+  ctx->recording = cnt;
+  /* tells whether a control in here holds the focus, see record_window() */
+  cnt->retained.updated_focus = ctx->updated_focus;
+  ctx->updated_focus = 0;
+  return MU_RES_ACTIVE;
+}
+
+
 void mu_open_popup(mu_Context *ctx, const char *name) {
   mu_Container *cnt = mu_get_container(ctx, name);
   /* set as hover root so popup isn't closed in begin_window_ex()  */
@@ -1198,10 +1783,11 @@ void mu_begin_panel_ex(mu_Context *ctx, const char *name, int opt) {
   mu_push_id(ctx, name, strlen(name));
   cnt = get_container(ctx, ctx->last_id, opt);
   cnt->rect = mu_layout_next(ctx);
+  cnt->root = mu_get_current_container(ctx)->root;
   if (~opt & MU_OPT_NOFRAME) {
     ctx->draw_frame(ctx, cnt->rect, MU_COLOR_PANELBG);
   }
-  push(ctx->container_stack, cnt);
+  push(ctx, ctx->container_stack, cnt);
   push_container_body(ctx, cnt, cnt->rect, opt);
   mu_push_clip_rect(ctx, cnt->body);
 }
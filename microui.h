@@ -8,23 +8,50 @@
 #ifndef MICROUI_H
 #define MICROUI_H
 
+#include <stddef.h>
+
 #define MU_VERSION "2.02"
 
-#define MU_COMMANDLIST_SIZE     (256 * 1024)
+/* initial capacities; the command list, stacks and pools grow as needed.
+** a pool grows once every entry in it was used in the same frame */
+#ifndef MU_COMMANDLIST_SIZE
+#define MU_COMMANDLIST_SIZE     (32 * 1024)
+#endif
+#ifndef MU_ROOTLIST_SIZE
 #define MU_ROOTLIST_SIZE        32
+#endif
+#ifndef MU_CONTAINERSTACK_SIZE
 #define MU_CONTAINERSTACK_SIZE  32
+#endif
+#ifndef MU_CLIPSTACK_SIZE
 #define MU_CLIPSTACK_SIZE       32
+#endif
+#ifndef MU_IDSTACK_SIZE
 #define MU_IDSTACK_SIZE         32
+#endif
+#ifndef MU_LAYOUTSTACK_SIZE
 #define MU_LAYOUTSTACK_SIZE     16
-#define MU_CONTAINERPOOL_SIZE   48
-#define MU_TREENODEPOOL_SIZE    48
+#endif
+#ifndef MU_CONTAINERPOOL_SIZE
+#define MU_CONTAINERPOOL_SIZE   128
+#endif
+#ifndef MU_TREENODEPOOL_SIZE
+#define MU_TREENODEPOOL_SIZE    1024
+#endif
+#ifndef MU_COMMANDTRIM_FRAMES
+#define MU_COMMANDTRIM_FRAMES   120 /* frames below the peak before spare chunks are freed */
+#endif
+#define MU_CONTAINERPAGE_SIZE   64 /* containers are allocated this many at a time */
+#define MU_TEXTWIDTH_CACHE_SIZE 1024 /* power of two; 4-way sets */
+#define MU_TEXTWIDTH_KEY_SIZE   32   /* longer strings are measured every time */
+#define MU_TEXTLINES_CACHE_SIZE 16
 #define MU_MAX_WIDTHS           16
 #define MU_REAL                 float
 #define MU_REAL_FMT             "%.3g"
 #define MU_SLIDER_FMT           "%.2f"
 #define MU_MAX_FMT              127
 
-#define mu_stack(T, n)          struct { int idx; T items[n]; }
+#define mu_stack(T)             struct { int idx; int cap; T *items; }
 #define mu_min(a, b)            ((a) < (b) ? (a) : (b))
 #define mu_max(a, b)            ((a) > (b) ? (a) : (b))
 #define mu_clamp(x, a, b)       mu_min(b, mu_max(a, x))
@@ -107,6 +134,7 @@ enum {
 
 
 typedef struct mu_Context mu_Context;
+typedef struct mu_CommandChunk mu_CommandChunk;
 typedef unsigned mu_Id;
 typedef MU_REAL mu_Real;
 typedef void* mu_Font;
@@ -114,7 +142,28 @@ typedef void* mu_Font;
 typedef struct { int x, y; } mu_Vec2;
 typedef struct { int x, y, w, h; } mu_Rect;
 typedef struct { unsigned char r, g, b, a; } mu_Color;
-typedef struct { mu_Id id; int last_update; } mu_PoolItem;
+typedef struct { mu_Id id; int last_update; int prev, next; } mu_PoolItem;
+typedef struct { mu_Font font; mu_Id hash; int len; int width; int last_update; char text[MU_TEXTWIDTH_KEY_SIZE]; } mu_TextWidth;
+
+typedef struct {
+  mu_Font font;
+  mu_Id hash;
+  int len;
+  char *text;       /* copy of the text, to tell colliding hashes apart */
+  int text_cap;
+  int width;        /* wrap width the lines were broken for */
+  int *ends;        /* offset of the end of each line; the next starts one later */
+  int count, cap;
+  int last_update;
+} mu_TextLines;
+
+typedef struct {
+  mu_PoolItem *items;
+  int len;
+  int *slots;       /* open addressing index over item ids: item index + 1, 0 is empty */
+  int slot_count;   /* twice len, so probes stay short */
+  int head, tail;   /* items by last use: head is the newest, tail the next to evict */
+} mu_Pool;
 
 typedef struct { int type, size; } mu_BaseCommand;
 typedef struct { mu_BaseCommand base; void *dst; } mu_JumpCommand;
@@ -148,15 +197,61 @@ typedef struct {
 } mu_Layout;
 
 typedef struct {
+  int count;
+  int first, last;  /* rows to lay out this frame: first <= i < last */
+  int top;          /* layout y of row 0 */
+  int height, step; /* row height, and the distance between two rows */
+} mu_Clipper;
+
+/* what a retained window's commands depend on, besides input */
+typedef struct {
+  unsigned version;
+  mu_Rect rect;
+  mu_Vec2 scroll;
+  mu_Vec2 content_size; /* decides the scrollbars */
+  int opt;
+  mu_Id style;
+} mu_RetainKey;
+
+/* a pool entry that a retained window's build touched */
+typedef struct { mu_Pool *pool; mu_Id id; } mu_PoolRef;
+
+typedef struct {
+  /* commands of the last build of a retained window */
+  char *commands;
+  int size, cap;
+  /* panels and open treenodes of that build, kept alive while it replays */
+  mu_PoolRef *refs;
+  int ref_count, ref_cap;
+  mu_RetainKey key;
+  int valid;
+  /* set while the window is being built */
+  int recording;
+  int roots;
+  int updated_focus;
+  struct mu_Container *outer; /* window that was recording before this one */
+} mu_Retained;
+
+typedef struct mu_Container {
   mu_Command *head, *tail;
   mu_Rect rect;
   mu_Rect body;
   mu_Vec2 content_size;
   mu_Vec2 scroll;
   int zindex;
+  struct mu_Container *below, *above; /* z-order list, see mu_bring_to_front() */
+  struct mu_Container *root;          /* root container this was last begun in */
+  int root_frame;                     /* frame this was last begun as a root */
   int open;
+  mu_Retained retained;
 } mu_Container;
 
+/* realloc-like: new_size 0 frees. old_size is passed so arenas can work */
+typedef struct {
+  void* (*realloc)(void *udata, void *ptr, size_t old_size, size_t new_size);
+  void *udata;
+} mu_Allocator;
+
 typedef struct {
   mu_Font font;
   mu_Vec2 size;
@@ -182,24 +277,41 @@ struct mu_Context {
   mu_Id last_id;
   mu_Rect last_rect;
   int last_zindex;
+  mu_Container *z_bottom, *z_top;
   int updated_focus;
   int frame;
   mu_Container *hover_root;
   mu_Container *next_hover_root;
   mu_Container *scroll_target;
+  mu_Container *recording; /* retained window being built, innermost */
   char number_edit_buf[MU_MAX_FMT];
   mu_Id number_edit;
+  mu_Allocator allocator;
+  /* command list: chunks joined by jump commands */
+  mu_CommandChunk *chunks;
+  mu_CommandChunk *chunk;
+  int chunk_idx;
+  int chunk_peak, chunk_quiet; /* most chunks used lately, frames since */
+  /* hash of the commands and root order, to tell an unchanged frame */
+  mu_Id frame_hash;
+  mu_Id last_frame_hash;
+  mu_Command *hash_pending;
   /* stacks */
-  mu_stack(char, MU_COMMANDLIST_SIZE) command_list;
-  mu_stack(mu_Container*, MU_ROOTLIST_SIZE) root_list;
-  mu_stack(mu_Container*, MU_CONTAINERSTACK_SIZE) container_stack;
-  mu_stack(mu_Rect, MU_CLIPSTACK_SIZE) clip_stack;
-  mu_stack(mu_Id, MU_IDSTACK_SIZE) id_stack;
-  mu_stack(mu_Layout, MU_LAYOUTSTACK_SIZE) layout_stack;
+  mu_stack(mu_Container*) root_list;
+  mu_stack(mu_Container*) container_stack;
+  mu_stack(mu_Rect) clip_stack;
+  mu_stack(mu_Id) id_stack;
+  mu_stack(mu_Layout) layout_stack;
   /* retained state pools */
-  mu_PoolItem container_pool[MU_CONTAINERPOOL_SIZE];
-  mu_Container containers[MU_CONTAINERPOOL_SIZE];
-  mu_PoolItem treenode_pool[MU_TREENODEPOOL_SIZE];
+  mu_Pool container_pool;
+  /* in pages, so containers stay put while the pool grows */
+  mu_Container **container_pages;
+  int container_page_count;
+  mu_Pool treenode_pool;
+  /* text_width() results by font and string hash */
+  mu_TextWidth text_widths[MU_TEXTWIDTH_CACHE_SIZE];
+  /* mu_text() line breaks by font, string hash and width */
+  mu_TextLines text_lines[MU_TEXTLINES_CACHE_SIZE];
   /* input state */
   mu_Vec2 mouse_pos;
   mu_Vec2 last_mouse_pos;
@@ -217,9 +329,10 @@ mu_Vec2 mu_vec2(int x, int y);
 mu_Rect mu_rect(int x, int y, int w, int h);
 mu_Color mu_color(int r, int g, int b, int a);
 
-void mu_init(mu_Context *ctx);
+void mu_init(mu_Context *ctx, const mu_Allocator *allocator);
+void mu_free(mu_Context *ctx);
 void mu_begin(mu_Context *ctx);
-void mu_end(mu_Context *ctx);
+int mu_end(mu_Context *ctx);
 void mu_set_focus(mu_Context *ctx, mu_Id id);
 mu_Id mu_get_id(mu_Context *ctx, const void *data, int size);
 void mu_push_id(mu_Context *ctx, const void *data, int size);
@@ -232,9 +345,10 @@ mu_Container* mu_get_current_container(mu_Context *ctx);
 mu_Container* mu_get_container(mu_Context *ctx, const char *name);
 void mu_bring_to_front(mu_Context *ctx, mu_Container *cnt);
 
-int mu_pool_init(mu_Context *ctx, mu_PoolItem *items, int len, mu_Id id);
-int mu_pool_get(mu_Context *ctx, mu_PoolItem *items, int len, mu_Id id);
-void mu_pool_update(mu_Context *ctx, mu_PoolItem *items, int idx);
+int mu_pool_init(mu_Context *ctx, mu_Pool *pool, mu_Id id);
+int mu_pool_get(mu_Context *ctx, mu_Pool *pool, mu_Id id);
+void mu_pool_update(mu_Context *ctx, mu_Pool *pool, int idx);
+void mu_pool_remove(mu_Context *ctx, mu_Pool *pool, int idx);
 
 void mu_input_mousemove(mu_Context *ctx, int x, int y);
 void mu_input_mousedown(mu_Context *ctx, int x, int y, int btn);
@@ -259,6 +373,10 @@ void mu_layout_begin_column(mu_Context *ctx);
 void mu_layout_end_column(mu_Context *ctx);
 void mu_layout_set_next(mu_Context *ctx, mu_Rect r, int relative);
 mu_Rect mu_layout_next(mu_Context *ctx);
+/* for long lists of same-height rows: lays out rows first to last only, and
+** accounts for the size of all count of them in mu_clipper_end() */
+void mu_clipper_begin(mu_Context *ctx, mu_Clipper *clipper, int count);
+void mu_clipper_end(mu_Context *ctx, mu_Clipper *clipper);
 
 void mu_draw_control_frame(mu_Context *ctx, mu_Id id, mu_Rect rect, int colorid, int opt);
 void mu_draw_control_text(mu_Context *ctx, const char *str, mu_Rect rect, int colorid, int opt);
@@ -286,6 +404,11 @@ int mu_header_ex(mu_Context *ctx, const char *label, int opt);
 int mu_begin_treenode_ex(mu_Context *ctx, const char *label, int opt);
 void mu_end_treenode(mu_Context *ctx);
 int mu_begin_window_ex(mu_Context *ctx, const char *title, mu_Rect rect, int opt);
+/* like mu_begin_window_ex(), but when version, rect, scroll, content size and style are
+** unchanged and the window is neither hovered nor focused, the previous frame's
+** commands are replayed and 0 is returned: skip the contents and
+** mu_end_window() as if the window were closed */
+int mu_begin_window_retained(mu_Context *ctx, const char *title, mu_Rect rect, int opt, unsigned version);
 void mu_end_window(mu_Context *ctx);
 void mu_open_popup(mu_Context *ctx, const char *name);
 int mu_begin_popup(mu_Context *ctx, const char *name);
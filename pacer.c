@@ -0,0 +1,105 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include "pacer.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define NS_PER_SEC 1000000000LL
+#define SPIN_MIN   50000LL   // 50us
+#define SPIN_START 1000000LL // 1ms until we know better
+
+int64_t pacer_now(void) {
+#if defined(_WIN32)
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if (!freq.QuadPart) { QueryPerformanceFrequency(&freq); }
+    QueryPerformanceCounter(&count);
+    // split to keep count * NS_PER_SEC from overflowing
+    return (count.QuadPart / freq.QuadPart) * NS_PER_SEC
+         + (count.QuadPart % freq.QuadPart) * NS_PER_SEC / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+static void sleep_ns(int64_t ns) {
+#if defined(_WIN32)
+    Sleep((DWORD)(ns / 1000000));
+#else
+    struct timespec ts = { ns / NS_PER_SEC, ns % NS_PER_SEC };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+void pacer_init(pacer *p, int hz) {
+    memset(p, 0, sizeof(*p));
+    p->period = NS_PER_SEC / (hz > 0 ? hz : 60);
+    p->spin = SPIN_START;
+    p->last = pacer_now();
+    p->deadline = p->last + p->period;
+}
+
+void pacer_sleep_until(pacer *p, int64_t t) {
+    int64_t now = pacer_now();
+    int64_t wake = t - p->spin;
+    if (wake > now) {
+        sleep_ns(wake - now);
+        now = pacer_now();
+
+        // grow the margin right away when the OS overslept, shrink it slowly otherwise
+        int64_t late = now - wake;
+        p->spin = late * 2 > p->spin ? late * 2 : p->spin - (p->spin - late * 2) / 16;
+        if (p->spin < SPIN_MIN) { p->spin = SPIN_MIN; }
+        if (p->spin > p->period / 2) { p->spin = p->period / 2; }
+    }
+    while (now < t) {
+        now = pacer_now();
+    }
+}
+
+void pacer_wait(pacer *p) {
+    int64_t now = pacer_now();
+    if (now >= p->deadline) {
+        // already late: start over from here rather than rushing to catch up
+        p->missed++;
+        p->deadline = now;
+    } else {
+        pacer_sleep_until(p, p->deadline);
+        now = pacer_now();
+
+        double late = (double)(now - p->deadline);
+        p->frames++;
+        double delta = late - p->mean;
+        p->mean += delta / p->frames;
+        p->m2 += delta * (late - p->mean);
+        if (now - p->deadline > p->max) { p->max = now - p->deadline; }
+    }
+    p->interval = now - p->last;
+    p->last = now;
+    p->deadline += p->period;
+}
+
+pacer_stats pacer_get_stats(const pacer *p) {
+    pacer_stats s = { .frames = p->frames, .missed = p->missed };
+    s.mean_us = p->mean / 1000.0;
+    s.max_us = p->max / 1000.0;
+    s.stddev_us = p->frames > 1 ? sqrt(p->m2 / (p->frames - 1)) / 1000.0 : 0;
+    s.fps = p->interval > 0 ? (double)NS_PER_SEC / p->interval : 0;
+    return s;
+}
+
+void pacer_reset_stats(pacer *p) {
+    p->frames = p->missed = p->max = 0;
+    p->mean = p->m2 = 0;
+}
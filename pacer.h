@@ -0,0 +1,40 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+// frame pacing on a monotonic nanosecond clock. pacer_wait() sleeps until a
+// little before the next deadline and spins the rest of the way, then moves the
+// deadline one period on. the spin margin follows how late the OS wakes us up.
+typedef struct {
+    int64_t period;   // ns per frame
+    int64_t deadline; // start of the next frame
+    int64_t spin;     // the last stretch before a deadline is spun instead of slept
+    int64_t last;     // when the previous wait returned
+    int64_t interval; // time between the last two frames
+
+    // lateness of each wakeup, for deadlines that were still ahead of us
+    int64_t frames;
+    int64_t missed;   // deadlines that had already passed when we got to wait
+    int64_t max;
+    double mean;
+    double m2;        // running sum of squared deviations (welford)
+} pacer;
+
+typedef struct {
+    int64_t frames;
+    int64_t missed;
+    double mean_us;
+    double max_us;
+    double stddev_us;
+    double fps;       // from the last frame interval
+} pacer_stats;
+
+int64_t pacer_now(void);
+void pacer_init(pacer *p, int hz);
+void pacer_wait(pacer *p);
+void pacer_sleep_until(pacer *p, int64_t t);
+pacer_stats pacer_get_stats(const pacer *p);
+void pacer_reset_stats(pacer *p);
+
+#endif
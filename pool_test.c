@@ -0,0 +1,56 @@
+// the renderer's worker pool must survive r_init() being called again with
+// several threads, like uibench does for every resolution: the frames drawn
+// by each new pool must match a single threaded reference exactly.
+//
+// usage: make test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "renderer.h"
+
+#define W 640
+#define H 480
+
+static void draw_frame(int frame) {
+    unsigned seed = 12345 + frame;
+    r_clear(mu_color(40, 40, 40, 255));
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        int x = (seed >> 8) % W, y = (seed >> 4) % H;
+        mu_Color c = mu_color(seed >> 24, seed >> 16, seed >> 8, 128 + (seed & 127));
+        if (i % 3) {
+            r_draw_rect(mu_rect(x, y, 1 + seed % 90, 1 + (seed >> 12) % 60), c);
+        } else {
+            r_draw_text("the quick brown fox", mu_vec2(x, y), c);
+        }
+    }
+    r_invalidate();
+    r_present();
+}
+
+int main(void) {
+    static uint32_t expected[4][W * H];
+    static uint32_t buf[W * H];
+    r_renderbuffer rb = { .data = buf, .width = W, .height = H };
+
+    r_init(rb, 1);
+    for (int f = 0; f < 4; f++) {
+        draw_frame(f);
+        memcpy(expected[f], buf, sizeof(buf));
+    }
+
+    int bad = 0;
+    for (int round = 0; round < 20; round++) {
+        r_init(rb, 2 + round % 7);
+        for (int f = 0; f < 4; f++) {
+            draw_frame(f);
+            bad += memcmp(expected[f], buf, sizeof(buf)) != 0;
+        }
+    }
+    r_init(rb, 1);
+
+    printf("%s: %s\n", bad ? "FAIL" : "ok  ", "frames match after repeated r_init() with threads");
+    return bad != 0;
+}
@@ -1,4 +1,7 @@
 #include <assert.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
@@ -6,19 +9,36 @@
 
 #include "renderer.h"
 #include "atlas.h"
+#include "atlas_spans.h"
 
-#define BUFFER_SIZE 16384
+#define BUFFER_SIZE 16384 // initial capacity; grows instead of flushing
 
 typedef uint8_t byte;
 
+enum { R_QUAD, R_MASK, R_LINE, R_WU_LINE, R_TRIANGLE, R_CIRCLE, R_FILL_CIRCLE };
+
 typedef struct {
-    mu_Rect dst_rect;   // destination on "screen"
-    mu_Color dst_color; // destination color
-    int atlas_src_id;   // source texture rect in atlas. opacity.
+    int type;
+    mu_Rect dst_rect;   // destination on "screen". bounding box for shapes
+    mu_Rect clip_rect;  // clip rect at the time the command was pushed
+    uint32_t color;     // premultiplied argb, packed once when the command is pushed
+    int atlas_src_id;   // source texture rect in atlas. opacity. text mask slot for R_MASK, index into shape_buf for shapes
+    unsigned hash;      // all of the above plus the shape or mask text. must stay last
 } r_command;
 
-static r_command cmd_buf[BUFFER_SIZE] = {};
+typedef struct {
+    mu_Vec2 p[3];  // line end points, triangle vertices, circle center
+    uint32_t c[3]; // premultiplied argb triangle vertex colors. c[0] for everything else
+    int radius;
+} r_shape;
+
+static r_command *cmd_buf;
 static int buf_idx;
+static int buf_cap;
+
+static r_shape *shape_buf;
+static int shape_idx;
+static int shape_cap;
 
 typedef struct {
   r_renderbuffer renderbuffer;
@@ -29,11 +49,29 @@ static r_framebuffer _framebuffer = {};
 
 #define r_pixel(f, x, y) ((f)->renderbuffer.data[((y) * (f)->renderbuffer.width) + (x)])
 
-void r_init(r_renderbuffer rb) {
+// advance per byte of text: the glyph width for ascii, 0 for utf-8
+// continuation bytes and the fallback glyph for the other upper bytes
+static byte char_width[256];
+
+static void select_span_kernels(void);
+static void init_tiles(int width, int height);
+static void start_pool(int threads);
+
+static void init_char_widths(void) {
+  for (int c = 0; c < 256; c++) {
+    char_width[c] = (c & 0xc0) == 0x80 ? 0 : atlas[ATLAS_FONT + mu_min(c, 127)].w;
+  }
+}
+
+void r_init(r_renderbuffer rb, int threads) {
   // init framebuffer
   memcpy(&_framebuffer.renderbuffer, &rb, sizeof(rb));
   _framebuffer.clip_rect = mu_rect(0, 0, rb.width, rb.height);
 
+  select_span_kernels();
+  init_char_widths();
+  init_tiles(rb.width, rb.height);
+  start_pool(threads);
   r_clear(mu_color(0, 0, 0, 255));
 }
 
@@ -50,116 +88,896 @@ static inline bool same_size(const mu_Rect* a, const mu_Rect* b) {
   return a->w == b->w && a->h == b->h;
 }
 
-static inline byte texture_color(const mu_Rect* tex, int x, int y) {
-  assert(x < tex->w);
-  x = x + tex->x;
-  assert(y < tex->h);
-  y = y + tex->y;
-  return atlas_texture[ y * ATLAS_WIDTH + x];
+// row y of an atlas rect, starting at column x
+static inline const byte *texture_row(const mu_Rect* tex, int x, int y) {
+  assert(x >= 0 && x < tex->w);
+  assert(y >= 0 && y < tex->h);
+  return &atlas_texture[(y + tex->y) * ATLAS_WIDTH + x + tex->x];
 }
 
-static inline uint32_t r_color(mu_Color clr) {
-//    union {
-//        uint32_t value;
-//        struct {
-//            uint8_t r;
-//            uint8_t g;
-//            uint8_t b;
-//            uint8_t a;
-//        } col;
-//    }
-  return ((uint32_t)clr.a << 24) | ((uint32_t)clr.r << 16) | ((uint32_t)clr.g << 8) | clr.b;
+// colors are premultiplied once when a command is pushed, and the framebuffer
+// holds premultiplied argb. divisions by 255 are exact: x / 255 rounded to
+// nearest is (x + 128 + ((x + 128) >> 8)) >> 8 for any x <= 255 * 255.
+
+// the division for two products at once, one in each 16 bit half. the sums stay
+// below 65536, so nothing carries into the other half.
+static inline uint32_t div255_2(uint32_t x) {
+  x += 0x800080;
+  return ((x + ((x >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
 }
 
-static inline mu_Color mu_color_argb(uint32_t clr) {
-    return (mu_Color) {
-        .a = (clr >> 24) & 0xff,
-        .r = (clr >> 16) & 0xff,
-        .g = (clr >> 8)  & 0xff,
-        .b = clr & 0xff,
-    };
-//  return mu_color((clr >> 16) & 0xff, (clr >> 8) & 0xff, clr & 0xff, (clr >> 24) & 0xff);
+// every channel of an argb word, alpha included, times a / 255
+static inline uint32_t scale_pixel(uint32_t c, uint32_t a) {
+  return div255_2((c & 0xff00ff) * a) | div255_2((c >> 8 & 0xff00ff) * a) << 8;
 }
 
-static inline int greyscale(byte c) {
-  return r_color(mu_color(c, c, c, 255));
+// premultiplied src over dst: src + dst * (255 - src.a) / 255 per channel. no
+// channel of src exceeds its alpha, so the sum cannot carry.
+static inline uint32_t over_pixel(uint32_t dst, uint32_t src) {
+  return src + scale_pixel(dst, 255 - (src >> 24));
 }
 
-static inline mu_Color blend_pixel(mu_Color dst, mu_Color src) {
-  int ia = 0xff - src.a;
-  dst.r = ((src.r * src.a) + (dst.r * ia)) >> 8;
-  dst.g = ((src.g * src.a) + (dst.g * ia)) >> 8;
-  dst.b = ((src.b * src.a) + (dst.b * ia)) >> 8;
-  return dst;
+static inline uint32_t premultiply(uint32_t c) {
+  return (scale_pixel(c, c >> 24) & 0xffffff) | (c & 0xff000000);
 }
 
-static inline mu_Color multiply_pixel(mu_Color a, mu_Color b) {
-    mu_Color final =  {
-        .r = (a.r * b.r) >> 8,
-        .g = (a.g * b.g) >> 8,
-        .b = (a.b * b.b) >> 8,
-        .a = (a.a * b.a) >> 8,
-    };
-    return final;
+/*============================================================================
+** span kernels
+**
+** flush() hands every row of a quad to one of these. the scalar versions are
+** the reference: the SIMD versions must produce the exact same pixels.
+**============================================================================*/
+
+#define SPAN_CHUNK 256
+
+#if !defined(R_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define R_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*r_span_fn)(uint32_t *dst, int n, uint32_t color);
+typedef void (*r_coverage_fn)(uint32_t *dst, const byte *coverage, int n, uint32_t color);
+
+typedef struct {
+    const char *name;
+    r_span_fn fill;          // opaque color
+    r_span_fn blend;         // constant alpha
+    r_coverage_fn coverage;  // per pixel alpha from the atlas
+} r_span_kernels;
+
+static void fill_span_scalar(uint32_t *dst, int n, uint32_t color) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = color;
+    }
 }
 
-static void flush(void) {
-    // draw things based on texture, vertex, color
-    for (int i = 0; i < buf_idx; i++) {
-        r_command cmd = cmd_buf[i];
-        mu_Rect tex = atlas[cmd.atlas_src_id];
-        mu_Rect dst = cmd.dst_rect;
-        mu_Color dst_color = cmd.dst_color;
-
-        // draw
-        int ystart = mu_max(dst.y, _framebuffer.clip_rect.y);
-        int yend = mu_min(dst.y + dst.h, _framebuffer.clip_rect.y + _framebuffer.clip_rect.h);
-        int xstart = mu_max(dst.x, _framebuffer.clip_rect.x);
-        int xend = mu_min(dst.x + dst.w, _framebuffer.clip_rect.x + _framebuffer.clip_rect.w);
-
-        mu_Real u_ratio = (mu_Real) tex.w / dst.w;
-        mu_Real v_ratio = (mu_Real) tex.h / dst.h;
+static void blend_span_scalar(uint32_t *dst, int n, uint32_t color) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = over_pixel(dst[i], color);
+    }
+}
+
+static void coverage_span_scalar(uint32_t *dst, const byte *coverage, int n, uint32_t color) {
+    for (int i = 0; i < n; i++) {
+        uint32_t src = scale_pixel(color, coverage[i]);
+        dst[i] = src >> 24 < 255 ? over_pixel(dst[i], src) : src;
+    }
+}
+
+static const r_span_kernels scalar_spans = {
+    "scalar", fill_span_scalar, blend_span_scalar, coverage_span_scalar
+};
+
+#if R_SIMD_X86
+// pixels are widened to 16 bits per channel. a product of two channels fits a
+// 16 bit lane, and div255 rounds it exactly like div255_2() does.
+
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// 255 - alpha in all four lanes of each widened pixel
+__attribute__((target("sse2")))
+static inline __m128i inv_alpha_sse2(__m128i s) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+    return _mm_sub_epi16(_mm_set1_epi16(255), a);
+}
+
+// widened premultiplied sources over 4 pixels
+__attribute__((target("sse2")))
+static inline __m128i over4_sse2(__m128i d, __m128i s_lo, __m128i s_hi, __m128i ia_lo, __m128i ia_hi) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(s_lo, div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo)));
+    __m128i hi = _mm_add_epi16(s_hi, div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi)));
+    return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("sse2")))
+static void fill_span_sse2(uint32_t *dst, int n, uint32_t color) {
+    __m128i c = _mm_set1_epi32((int)color);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+    fill_span_scalar(dst + i, n - i, color);
+}
+
+__attribute__((target("sse2")))
+static void blend_span_sse2(uint32_t *dst, int n, uint32_t color) {
+    __m128i s = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), _mm_setzero_si128());
+    __m128i ia = inv_alpha_sse2(s);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128((__m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), over4_sse2(d, s, s, ia, ia));
+    }
+    blend_span_scalar(dst + i, n - i, color);
+}
+
+__attribute__((target("sse2")))
+static void coverage_span_sse2(uint32_t *dst, const byte *coverage, int n, uint32_t color) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i c = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t c4;
+        memcpy(&c4, coverage + i, sizeof(c4));
+        // one coverage per 32 bit lane, splat to all 4 bytes and widened
+        __m128i a = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)c4), zero), zero);
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        __m128i s_lo = div255_sse2(_mm_mullo_epi16(c, _mm_unpacklo_epi8(a, zero)));
+        __m128i s_hi = div255_sse2(_mm_mullo_epi16(c, _mm_unpackhi_epi8(a, zero)));
+        __m128i d = _mm_loadu_si128((__m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         over4_sse2(d, s_lo, s_hi, inv_alpha_sse2(s_lo), inv_alpha_sse2(s_hi)));
+    }
+    coverage_span_scalar(dst + i, coverage + i, n - i, color);
+}
+
+static const r_span_kernels sse2_spans = {
+    "sse2", fill_span_sse2, blend_span_sse2, coverage_span_sse2
+};
+
+// same as the sse2 kernels, 8 pixels at a time. unpack/pack and the shuffles
+// work per 128 bit lane, so the pixel order survives the round trip.
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i inv_alpha_avx2(__m256i s) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+    return _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i over8_avx2(__m256i d, __m256i s_lo, __m256i s_hi, __m256i ia_lo, __m256i ia_hi) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi16(s_lo, div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia_lo)));
+    __m256i hi = _mm256_add_epi16(s_hi, div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia_hi)));
+    return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void fill_span_avx2(uint32_t *dst, int n, uint32_t color) {
+    __m256i c = _mm256_set1_epi32((int)color);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i *)(dst + i), c);
+    }
+    fill_span_scalar(dst + i, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static void blend_span_avx2(uint32_t *dst, int n, uint32_t color) {
+    __m256i s = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), _mm256_setzero_si256());
+    __m256i ia = inv_alpha_avx2(s);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256((__m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), over8_avx2(d, s, s, ia, ia));
+    }
+    blend_span_sse2(dst + i, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static void coverage_span_avx2(uint32_t *dst, const byte *coverage, int n, uint32_t color) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i c = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(coverage + i)));
+        a = _mm256_mullo_epi32(a, _mm256_set1_epi32(0x01010101));
+        __m256i s_lo = div255_avx2(_mm256_mullo_epi16(c, _mm256_unpacklo_epi8(a, zero)));
+        __m256i s_hi = div255_avx2(_mm256_mullo_epi16(c, _mm256_unpackhi_epi8(a, zero)));
+        __m256i d = _mm256_loadu_si256((__m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            over8_avx2(d, s_lo, s_hi, inv_alpha_avx2(s_lo), inv_alpha_avx2(s_hi)));
+    }
+    coverage_span_sse2(dst + i, coverage + i, n - i, color);
+}
+
+static const r_span_kernels avx2_spans = {
+    "avx2", fill_span_avx2, blend_span_avx2, coverage_span_avx2
+};
+#endif
+
+static r_span_kernels spans;
+
+static void select_span_kernels(void) {
+    spans = scalar_spans;
+#if R_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) { spans = sse2_spans; }
+    if (__builtin_cpu_supports("avx2")) { spans = avx2_spans; }
+#endif
+}
+
+static inline mu_Rect intersect(mu_Rect a, mu_Rect b) {
+    int x = mu_max(a.x, b.x);
+    int y = mu_max(a.y, b.y);
+    int w = mu_min(a.x + a.w, b.x + b.w) - x;
+    int h = mu_min(a.y + a.h, b.y + b.h) - y;
+    return mu_rect(x, y, mu_max(w, 0), mu_max(h, 0));
+}
+
+// the pixels a command may touch: its destination clipped to its clip rect.
+static inline mu_Rect command_area(const r_command *cmd) {
+    return intersect(cmd->dst_rect, cmd->clip_rect);
+}
+
+static inline mu_Rect screen_rect(void) {
+    return mu_rect(0, 0, _framebuffer.renderbuffer.width, _framebuffer.renderbuffer.height);
+}
+
+static void fill_rect(mu_Rect area, uint32_t color) {
+    for (int y = area.y; y < area.y + area.h; y++) {
+        spans.fill(&r_pixel(&_framebuffer, area.x, y), area.w, color);
+    }
+}
+
+static void draw_quad(const r_command *cmd, mu_Rect area) {
+    mu_Rect tex = atlas[cmd->atlas_src_id];
+    mu_Rect dst = cmd->dst_rect;
+    uint32_t color = cmd->color;
+
+    int ystart = area.y;
+    int yend = area.y + area.h;
+    int xstart = area.x;
+    int xend = area.x + area.w;
+    if (xstart >= xend) { return; }
+
+    if (cmd->atlas_src_id == ATLAS_WHITE) {
+        // solid quad: one span per row, opaque colors skip the blend entirely
+        r_span_fn span = color >> 24 < 255 ? spans.blend : spans.fill;
+        for (int y = ystart; y < yend; y++) {
+            span(&r_pixel(&_framebuffer, xstart, y), xend - xstart, color);
+        }
+        return;
+    }
+
+    // texture contains opacity values only, and blends as a span of coverage.
+    if (same_size(&tex, &dst)) {
+        // glyphs and icons are drawn at atlas size and walk their runs from
+        // atlas_spans.h: transparent texels are skipped, opaque runs are solid.
+        const unsigned short *rows = &atlas_rows[atlas_row_start[cmd->atlas_src_id]];
+        r_span_fn solid = color >> 24 < 255 ? spans.blend : spans.fill;
         for (int y = ystart; y < yend; y++) {
-            for (int x = xstart; x < xend; x++) {
-                assert(within_rect(dst, x, y));
-                assert(within_rect(_framebuffer.clip_rect, x, y));
+            int ty = y - dst.y;
+            const byte *texels = texture_row(&tex, 0, ty);
+            for (int k = rows[ty]; k < rows[ty + 1]; k++) {
+                int x0 = mu_max(xstart, dst.x + atlas_runs[k].x);
+                int x1 = mu_min(xend, dst.x + atlas_runs[k].x + atlas_runs[k].len);
+                if (x0 >= x1) { continue; }
+                uint32_t *p = &r_pixel(&_framebuffer, x0, y);
+                if (atlas_runs[k].opaque) {
+                    solid(p, x1 - x0, color);
+                } else {
+                    spans.coverage(p, texels + x0 - dst.x, x1 - x0, color);
+                }
+            }
+        }
+        return;
+    }
+
+    // scaled: nearest texel, stepped in 16.16 fixed point.
+    uint32_t u_step = ((uint32_t)tex.w << 16) / dst.w;
+    uint32_t v_step = ((uint32_t)tex.h << 16) / dst.h;
+    byte coverage[SPAN_CHUNK];
+    for (int y = ystart; y < yend; y++) {
+        const byte *row = texture_row(&tex, 0, (y - dst.y) * v_step >> 16);
+        for (int x0 = xstart; x0 < xend; x0 += SPAN_CHUNK) {
+            int n = mu_min(SPAN_CHUNK, xend - x0);
+            uint32_t u = (x0 - dst.x) * u_step;
+            for (int j = 0; j < n; j++, u += u_step) {
+                coverage[j] = row[u >> 16];
+            }
+            spans.coverage(&r_pixel(&_framebuffer, x0, y), coverage, n, color);
+        }
+    }
+}
+
+static void raster_line(const r_shape *s, mu_Rect clip);
+static void raster_wu_line(const r_shape *s, mu_Rect clip);
+static void raster_triangle(const r_shape *s, mu_Rect clip);
+static void raster_circle(const r_shape *s, mu_Rect clip);
+static void raster_fill_circle(const r_shape *s, mu_Rect clip);
+static void draw_mask(const r_command *cmd, mu_Rect area);
+
+// draws the part of cmd that lies within area. area must be inside the command's
+// destination and the clip rect.
+static void draw_command(const r_command *cmd, mu_Rect area) {
+    const r_shape *shape = &shape_buf[cmd->atlas_src_id];
+    switch (cmd->type) {
+        case R_QUAD:        draw_quad(cmd, area); break;
+        case R_MASK:        draw_mask(cmd, area); break;
+        case R_LINE:        raster_line(shape, area); break;
+        case R_WU_LINE:     raster_wu_line(shape, area); break;
+        case R_TRIANGLE:    raster_triangle(shape, area); break;
+        case R_CIRCLE:      raster_circle(shape, area); break;
+        case R_FILL_CIRCLE: raster_fill_circle(shape, area); break;
+    }
+}
+
+/*============================================================================
+** tile binning
+**
+** push_command() counts how many commands touch each TILE_SIZE x TILE_SIZE
+** tile. flush() turns the counts into per-tile command lists and then draws
+** tile by tile, so a tile's pixels stay in cache while all of its commands run.
+** every tile keeps submission order and every command carries its own clip
+** rect, so each pixel sees the exact same sequence of writes as before.
+**
+** the tiles also drive damage tracking: a tile's signature is the clear color
+** plus the hashes of its commands in order. a tile whose signature matches the
+** previous frame already holds the right pixels and is neither cleared nor
+** drawn, and only the changed tiles are reported by r_get_damage().
+**============================================================================*/
+
+#define TILE_SIZE 64
+
+static bool binning = true;
+static int tiles_x, tiles_y;
+static int *tile_count;     // commands per tile for the current batch
+static int *tile_start;     // offset of each tile's list in tile_bins. tiles + 1 entries
+static int *tile_bins;      // command indices grouped by tile
+static int bins_cap;
+static int *tile_list;      // tiles to draw in this batch
+static int tile_list_len;
+static unsigned *tile_sig;  // signature of what each tile shows. 0 is unknown
+static bool *tile_dirty;
+
+static bool frame_cleared;  // r_clear() was called since the last flush
+static unsigned text_batch; // counts flushes. masks queued since the last one are not evicted
+static uint32_t clear_color;
+static bool full_redraw;    // ignore signatures on the next flush
+
+static mu_Rect *damage;
+static int damage_len;
+
+static void init_tiles(int width, int height) {
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    free(tile_count);
+    free(tile_start);
+    free(tile_list);
+    free(tile_sig);
+    free(tile_dirty);
+    free(damage);
+    tile_count = calloc(tiles_x * tiles_y, sizeof(*tile_count));
+    tile_start = calloc(tiles_x * tiles_y + 1, sizeof(*tile_start));
+    tile_list = calloc(tiles_x * tiles_y, sizeof(*tile_list));
+    tile_sig = calloc(tiles_x * tiles_y, sizeof(*tile_sig));
+    tile_dirty = calloc(tiles_x * tiles_y, sizeof(*tile_dirty));
+    damage = calloc(tiles_x * tiles_y, sizeof(*damage));
+    assert(tile_count && tile_start && tile_list && tile_sig && tile_dirty && damage);
+    full_redraw = true;
+}
+
+static inline mu_Rect tile_rect(int tx, int ty) {
+    return mu_rect(tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+}
 
-                mu_Color existing_color = mu_color_argb(r_pixel(&_framebuffer, x, y));
-                mu_Color out_color = dst_color;
+#define for_each_tile(area, tx, ty)                                                      \
+    for (int ty = (area).y / TILE_SIZE; ty <= ((area).y + (area).h - 1) / TILE_SIZE; ty++) \
+        for (int tx = (area).x / TILE_SIZE; tx <= ((area).x + (area).w - 1) / TILE_SIZE; tx++)
 
-                if (cmd.atlas_src_id != ATLAS_WHITE) {
-                    mu_Real u = (x - dst.x) * u_ratio;
-                    mu_Real v = (y - dst.y) * v_ratio;
+// 32bit fnv-1a over whole words; commands and shapes are made of 4 byte fields.
+#define HASH_INITIAL 2166136261
 
-                    // texture contains opacity values only.
-                    byte tc = texture_color(&tex, u, v);
-                    out_color = multiply_pixel(mu_color(255, 255, 255, tc), out_color);
+static inline void hash_words(unsigned *hash, const void *data, size_t size) {
+    const byte *p = data;
+    for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, p + i, sizeof(word));
+        *hash = (*hash ^ word) * 16777619;
+    }
+}
+
+static void draw_tile(int t) {
+    mu_Rect tile = intersect(tile_rect(t % tiles_x, t / tiles_x), screen_rect());
+    if (frame_cleared) {
+        fill_rect(tile, clear_color);
+    }
+    for (int k = tile_start[t]; k < tile_start[t + 1]; k++) {
+        const r_command *cmd = &cmd_buf[tile_bins[k]];
+        draw_command(cmd, intersect(command_area(cmd), tile));
+    }
+}
+
+// merges the dirty tiles into rects: runs of tiles within a row, then runs that
+// line up with a rect ending right above them.
+static void collect_damage(const bool *dirty) {
+    damage_len = 0;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            if (!dirty[ty * tiles_x + tx]) { continue; }
+            int tx1 = tx;
+            while (tx1 < tiles_x && dirty[ty * tiles_x + tx1]) { tx1++; }
+            mu_Rect r = intersect(mu_rect(tx * TILE_SIZE, ty * TILE_SIZE, (tx1 - tx) * TILE_SIZE, TILE_SIZE), screen_rect());
+            tx = tx1;
+
+            bool merged = false;
+            for (int i = 0; i < damage_len; i++) {
+                mu_Rect *above = &damage[i];
+                if (above->x == r.x && above->w == r.w && above->y + above->h == r.y) {
+                    above->h += r.h;
+                    merged = true;
+                    break;
                 }
+            }
+            if (!merged) {
+                damage[damage_len++] = r;
+            }
+        }
+    }
+}
+
+/*============================================================================
+** worker pool
+**
+** r_init() can start threads - 1 workers; the calling thread is worker 0. a
+** binned flush hands out tiles: every worker owns a contiguous range of the
+** tile list, drains it, and then steals whatever is left in the others'
+** ranges. a tile is only ever drawn by one thread and always runs its own
+** command list in order, so the result does not depend on who drew what.
+**============================================================================*/
+
+#define MAX_THREADS 64
+
+typedef struct {
+    atomic_int next; // next unclaimed entry of tile_list
+    int end;
+} r_tile_queue;
+
+static int pool_threads = 1;
+static pthread_t pool_workers[MAX_THREADS];
+static r_tile_queue pool_queues[MAX_THREADS];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned pool_generation;
+static int pool_busy;
+static bool pool_quit;
+
+static inline bool claim_tile(r_tile_queue *q, int *t) {
+    if (atomic_load_explicit(&q->next, memory_order_relaxed) >= q->end) { return false; }
+    int i = atomic_fetch_add_explicit(&q->next, 1, memory_order_relaxed);
+    if (i >= q->end) { return false; }
+    *t = tile_list[i];
+    return true;
+}
+
+static void draw_tiles(int worker) {
+    int t;
+    for (int i = 0; i < pool_threads; i++) {
+        // own queue first, then walk the others
+        r_tile_queue *q = &pool_queues[(worker + i) % pool_threads];
+        while (claim_tile(q, &t)) {
+            draw_tile(t);
+        }
+    }
+}
+
+static void *pool_worker(void *arg) {
+    int worker = (int)(intptr_t)arg;
+    unsigned seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool_lock);
+        while (pool_generation == seen && !pool_quit) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if (pool_quit) {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+        seen = pool_generation;
+        pthread_mutex_unlock(&pool_lock);
+
+        draw_tiles(worker);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_busy == 0) { pthread_cond_signal(&pool_done); }
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+static void stop_pool(void) {
+    pthread_mutex_lock(&pool_lock);
+    pool_quit = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (int i = 1; i < pool_threads; i++) {
+        pthread_join(pool_workers[i], NULL);
+    }
+    // new workers start out having seen generation 0
+    pthread_mutex_lock(&pool_lock);
+    pool_generation = 0;
+    pool_quit = false;
+    pthread_mutex_unlock(&pool_lock);
+    pool_threads = 1;
+}
+
+static void start_pool(int threads) {
+    stop_pool();
+    pool_threads = mu_clamp(threads, 1, MAX_THREADS);
+    for (int i = 1; i < pool_threads; i++) {
+        if (pthread_create(&pool_workers[i], NULL, pool_worker, (void *)(intptr_t)i) != 0) {
+            // run with however many workers we got
+            pool_threads = i;
+            break;
+        }
+    }
+}
+
+static void draw_dirty_tiles(void) {
+    // small batches are not worth waking the workers for.
+    if (pool_threads < 2 || tile_list_len < 2 * pool_threads) {
+        for (int i = 0; i < tile_list_len; i++) {
+            draw_tile(tile_list[i]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < pool_threads; i++) {
+        atomic_store_explicit(&pool_queues[i].next, tile_list_len * i / pool_threads, memory_order_relaxed);
+        pool_queues[i].end = tile_list_len * (i + 1) / pool_threads;
+    }
 
-                mu_Color result = out_color.a < 255 ? blend_pixel(existing_color, out_color) : out_color;
-                r_pixel(&_framebuffer, x, y) = r_color(result);
+    pthread_mutex_lock(&pool_lock);
+    pool_busy = pool_threads - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    draw_tiles(0);
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_busy > 0) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void flush_binned(void) {
+    int ntiles = tiles_x * tiles_y;
+
+    // prefix sum the counts into list offsets; the counts become write cursors.
+    int total = 0;
+    for (int t = 0; t < ntiles; t++) {
+        tile_start[t] = total;
+        total += tile_count[t];
+        tile_count[t] = 0;
+    }
+    tile_start[ntiles] = total;
+
+    if (total > bins_cap) {
+        bins_cap = mu_max(total, bins_cap * 2);
+        tile_bins = realloc(tile_bins, bins_cap * sizeof(*tile_bins));
+        assert(tile_bins);
+    }
+
+    for (int i = 0; i < buf_idx; i++) {
+        mu_Rect area = command_area(&cmd_buf[i]);
+        for_each_tile(area, tx, ty) {
+            int t = ty * tiles_x + tx;
+            tile_bins[tile_start[t] + tile_count[t]++] = i;
+        }
+    }
+    memset(tile_count, 0, ntiles * sizeof(*tile_count));
+
+    // find the tiles whose contents change. without a clear, commands are drawn
+    // over whatever is there, so every tile they touch changes and its
+    // signature no longer describes it.
+    bool *dirty = tile_dirty;
+    tile_list_len = 0;
+    for (int t = 0; t < ntiles; t++) {
+        if (frame_cleared) {
+            unsigned sig = HASH_INITIAL;
+            hash_words(&sig, &clear_color, sizeof(clear_color));
+            for (int k = tile_start[t]; k < tile_start[t + 1]; k++) {
+                hash_words(&sig, &cmd_buf[tile_bins[k]].hash, sizeof(unsigned));
             }
+            sig += !sig;
+            dirty[t] = full_redraw || sig != tile_sig[t];
+            tile_sig[t] = sig;
+        } else {
+            dirty[t] = tile_start[t + 1] > tile_start[t];
+            if (dirty[t]) { tile_sig[t] = 0; }
         }
+        if (dirty[t]) { tile_list[tile_list_len++] = t; }
+    }
+    collect_damage(dirty);
+    full_redraw = false;
+
+    draw_dirty_tiles();
+}
+
+static void flush_direct(void) {
+    if (frame_cleared) {
+        fill_rect(screen_rect(), clear_color);
+    }
+    for (int i = 0; i < buf_idx; i++) {
+        draw_command(&cmd_buf[i], command_area(&cmd_buf[i]));
+    }
+    // nothing is tracked here: report everything and redraw it all once binning is back.
+    damage_len = 0;
+    if (frame_cleared || buf_idx > 0) {
+        damage[damage_len++] = screen_rect();
+    }
+    full_redraw = true;
+}
+
+static void flush(void) {
+    // draw things based on texture, vertex, color
+    if (binning) {
+        flush_binned();
+    } else {
+        flush_direct();
     }
     buf_idx = 0;
+    shape_idx = 0;
+    frame_cleared = false;
+    text_batch++;
 }
 
-static void push_quad(mu_Rect dst, int src_id, mu_Color color) {
-    if (buf_idx == BUFFER_SIZE) { flush(); }
+// drops everything queued since the last flush.
+static void discard(void) {
+    buf_idx = 0;
+    shape_idx = 0;
+    memset(tile_count, 0, tiles_x * tiles_y * sizeof(*tile_count));
+}
+
+/*============================================================================
+** text masks
+**
+** r_draw_text() composites a whole string into one coverage mask and queues a
+** single R_MASK command for it instead of a quad per glyph. masks are cached by
+** the text and reused, in any color, by every later frame that draws the same
+** string. when the masks outgrow the budget the least recently used ones are
+** freed, but never one that a queued command still points at: text that does
+** not fit then falls back to glyph quads.
+**============================================================================*/
+
+#ifndef R_TEXT_CACHE_BUDGET
+#define R_TEXT_CACHE_BUDGET (4 << 20) // bytes of masks and keys
+#endif
+#define TEXT_CACHE_SLOTS 4096         // power of two, also the number of buckets
+
+typedef struct {
+    unsigned key;     // hash of the text
+    int len;
+    int w, h;
+    byte *data;       // w * h coverage, followed by the text itself
+    int prev, next;   // lru list, most recent first
+    int chain;        // next slot in the bucket, or in the free list
+    unsigned batch;   // last flush it was queued for
+} r_text_mask;
+
+// slot 0 is the head of the circular lru list; 0 also ends the chains.
+static r_text_mask text_masks[TEXT_CACHE_SLOTS];
+static int text_buckets[TEXT_CACHE_SLOTS];
+static int text_free;      // free list of released slots
+static int text_slots = 1; // slots handed out so far, the head included
+static r_text_cache_stats text_stats = { .budget = R_TEXT_CACHE_BUDGET };
+
+static inline unsigned hash_text(const char *text, int len) {
+    unsigned h = HASH_INITIAL;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (byte)text[i]) * 16777619;
+    }
+    return h;
+}
+
+static inline size_t text_mask_size(const r_text_mask *m) {
+    return (size_t)m->w * m->h + m->len;
+}
+
+static void lru_unlink(int i) {
+    text_masks[text_masks[i].prev].next = text_masks[i].next;
+    text_masks[text_masks[i].next].prev = text_masks[i].prev;
+}
+
+static void lru_push_front(int i) {
+    text_masks[i].prev = 0;
+    text_masks[i].next = text_masks[0].next;
+    text_masks[text_masks[0].next].prev = i;
+    text_masks[0].next = i;
+}
+
+static void evict_text_mask(int i) {
+    r_text_mask *m = &text_masks[i];
+    int *link = &text_buckets[m->key & (TEXT_CACHE_SLOTS - 1)];
+    while (*link != i) { link = &text_masks[*link].chain; }
+    *link = m->chain;
+    lru_unlink(i);
+
+    text_stats.bytes -= text_mask_size(m);
+    text_stats.entries--;
+    text_stats.evictions++;
+    free(m->data);
+    m->data = NULL;
+    m->chain = text_free;
+    text_free = i;
+}
+
+// frees least recently used masks until size more bytes fit the budget
+static bool make_room(size_t size) {
+    while (text_stats.bytes + size > text_stats.budget) {
+        int oldest = text_masks[0].prev;
+        if (!oldest || text_masks[oldest].batch == text_batch) { return false; }
+        evict_text_mask(oldest);
+    }
+    return true;
+}
+
+static int alloc_text_slot(void) {
+    if (text_free) {
+        int i = text_free;
+        text_free = text_masks[i].chain;
+        return i;
+    }
+    if (text_slots < TEXT_CACHE_SLOTS) { return text_slots++; }
+    int oldest = text_masks[0].prev;
+    if (!oldest || text_masks[oldest].batch == text_batch) { return 0; }
+    evict_text_mask(oldest);
+    return alloc_text_slot();
+}
+
+// the slot holding the mask of text, built on a miss. 0 if it does not fit.
+static int find_text_mask(const char *text, int len) {
+    unsigned key = hash_text(text, len);
+    int *bucket = &text_buckets[key & (TEXT_CACHE_SLOTS - 1)];
+    for (int i = *bucket; i; i = text_masks[i].chain) {
+        r_text_mask *m = &text_masks[i];
+        if (m->key == key && m->len == len && !memcmp(m->data + m->w * m->h, text, len)) {
+            lru_unlink(i);
+            lru_push_front(i);
+            m->batch = text_batch;
+            text_stats.hits++;
+            return i;
+        }
+    }
+    text_stats.misses++;
+
+    r_text_mask m = { .key = key, .len = len, .w = r_get_text_width(text, len), .batch = text_batch };
+    for (int i = 0; i < len; i++) {
+        if ((text[i] & 0xc0) == 0x80) { continue; }
+        m.h = mu_max(m.h, atlas[ATLAS_FONT + mu_min((byte)text[i], 127)].h);
+    }
+    size_t size = text_mask_size(&m);
+    if (size > text_stats.budget || !make_room(size)) { return 0; }
+    int slot = alloc_text_slot();
+    if (!slot) { return 0; }
+    m.data = calloc(size, 1);
+    assert(m.data);
+
+    // glyphs sit side by side, so their coverage is copied, not blended
+    int x = 0;
+    for (int i = 0; i < len; i++) {
+        if ((text[i] & 0xc0) == 0x80) { continue; }
+        mu_Rect src = atlas[ATLAS_FONT + mu_min((byte)text[i], 127)];
+        for (int y = 0; y < src.h; y++) {
+            memcpy(m.data + y * m.w + x, &atlas_texture[(src.y + y) * ATLAS_WIDTH + src.x], src.w);
+        }
+        x += src.w;
+    }
+    memcpy(m.data + m.w * m.h, text, len);
+
+    m.chain = *bucket;
+    *bucket = slot;
+    text_masks[slot] = m;
+    lru_push_front(slot);
+    text_stats.bytes += size;
+    text_stats.entries++;
+    return slot;
+}
+
+static void draw_mask(const r_command *cmd, mu_Rect area) {
+    const r_text_mask *m = &text_masks[cmd->atlas_src_id];
+    mu_Rect dst = cmd->dst_rect;
+    for (int y = area.y; y < area.y + area.h; y++) {
+        const byte *row = m->data + (y - dst.y) * m->w + area.x - dst.x;
+        spans.coverage(&r_pixel(&_framebuffer, area.x, y), row, area.w, cmd->color);
+    }
+}
+
+r_text_cache_stats r_get_text_cache_stats(void) {
+    return text_stats;
+}
+
+void r_set_text_cache_budget(size_t bytes) {
+    text_stats.budget = bytes;
+    make_room(0);
+}
+
+static void push_command(r_command cmd, const r_shape *shape) {
+    cmd.clip_rect = _framebuffer.clip_rect;
+
+    // nothing of it is visible; skip it.
+    mu_Rect area = command_area(&cmd);
+    if (area.w <= 0 || area.h <= 0) { return; }
+
+    if (shape) {
+        if (shape_idx == shape_cap) {
+            shape_cap = shape_cap ? shape_cap * 2 : 256;
+            shape_buf = realloc(shape_buf, shape_cap * sizeof(*shape_buf));
+            assert(shape_buf);
+        }
+        cmd.atlas_src_id = shape_idx;
+        shape_buf[shape_idx++] = *shape;
+    }
+
+    cmd.hash = HASH_INITIAL;
+    hash_words(&cmd.hash, &cmd, offsetof(r_command, hash));
+    if (shape) { hash_words(&cmd.hash, shape, sizeof(*shape)); }
+    // a mask slot can hold other text next frame
+    if (cmd.type == R_MASK) { hash_words(&cmd.hash, &text_masks[cmd.atlas_src_id].key, sizeof(unsigned)); }
+
+    if (binning) {
+        for_each_tile(area, tx, ty) {
+            tile_count[ty * tiles_x + tx]++;
+        }
+    }
 
-    cmd_buf[buf_idx] = (r_command){
+    if (buf_idx == buf_cap) {
+        buf_cap = buf_cap ? buf_cap * 2 : BUFFER_SIZE;
+        cmd_buf = realloc(cmd_buf, buf_cap * sizeof(*cmd_buf));
+        assert(cmd_buf);
+    }
+    cmd_buf[buf_idx] = cmd;
+    buf_idx++;
+}
+
+static void push_quad(mu_Rect dst, int src_id, mu_Color color) {
+    push_command((r_command){
+        .type = R_QUAD,
         .dst_rect = dst,
-        .dst_color = color,
+        .color = premultiply(r_color(color)),
         .atlas_src_id = src_id,
-    };
-    buf_idx++;
+    }, NULL);
+}
+
+static void push_shape(int type, mu_Rect bounds, r_shape shape) {
+    push_command((r_command){ .type = type, .dst_rect = bounds }, &shape);
+}
+
+void r_set_binning(bool enabled) {
+    flush();
+    binning = enabled;
 }
 
 void r_draw_rect(mu_Rect rect, mu_Color color) {
   push_quad(rect, ATLAS_WHITE, color);
 }
 
-void r_draw_text(const char *text, mu_Vec2 pos, mu_Color color) {
+static void draw_glyphs(const char *text, mu_Vec2 pos, mu_Color color) {
   mu_Rect dst = { pos.x, pos.y, 0, 0 };
   for (const char *p = text; *p; p++) {
     if ((*p & 0xc0) == 0x80) { continue; }
@@ -172,6 +990,32 @@ void r_draw_text(const char *text, mu_Vec2 pos, mu_Color color) {
   }
 }
 
+void r_draw_text(const char *text, mu_Vec2 pos, mu_Color color) {
+  // a single glyph is one quad either way
+  int len = strlen(text);
+  if (len < 2) {
+    draw_glyphs(text, pos, color);
+    return;
+  }
+  // don't build masks for text that is clipped away
+  mu_Rect dst = mu_rect(pos.x, pos.y, r_get_text_width(text, len), r_get_text_height());
+  mu_Rect area = intersect(dst, _framebuffer.clip_rect);
+  if (area.w <= 0 || area.h <= 0) { return; }
+
+  int slot = find_text_mask(text, len);
+  if (!slot) {
+    draw_glyphs(text, pos, color);
+    return;
+  }
+  dst.h = text_masks[slot].h;
+  push_command((r_command){
+      .type = R_MASK,
+      .dst_rect = dst,
+      .color = premultiply(r_color(color)),
+      .atlas_src_id = slot,
+  }, NULL);
+}
+
 void r_draw_icon(int id, mu_Rect rect, mu_Color color) {
   mu_Rect src = atlas[id];
   int x = rect.x + (rect.w - src.w) / 2;
@@ -180,13 +1024,23 @@ void r_draw_icon(int id, mu_Rect rect, mu_Color color) {
 }
 
 int r_get_text_width(const char *text, int len) {
-  int res = 0;
-  for (const char *p = text; *p && len--; p++) {
-    if ((*p & 0xc0) == 0x80) { continue; }
-    int chr = mu_min((unsigned char) *p, 127);
-    res += atlas[ATLAS_FONT + chr].w;
+  // find the end first, then the loop is a table lookup per byte with no
+  // branches for the terminator or utf-8
+  const byte *p = (const byte *) text;
+  const byte *end = len < 0 ? p + strlen(text) : memchr(p, 0, len);
+  if (!end) { end = p + len; }
+
+  int a = 0, b = 0, c = 0, d = 0;
+  for (; end - p >= 4; p += 4) {
+    a += char_width[p[0]];
+    b += char_width[p[1]];
+    c += char_width[p[2]];
+    d += char_width[p[3]];
+  }
+  for (; p < end; p++) {
+    a += char_width[*p];
   }
-  return res;
+  return a + b + c + d;
 }
 
 int r_get_text_height(void) {
@@ -194,8 +1048,7 @@ int r_get_text_height(void) {
 }
 
 void r_set_clip_rect(mu_Rect rect) {
-  flush();
-  // TODO: we could simply store a clip stack to avoid flushes...
+  // queued commands keep the clip rect they were pushed with, so no flush is needed.
   int ystart = mu_max(0, rect.y);
   int yend = mu_min(_framebuffer.renderbuffer.height, rect.y + rect.h);
   int xstart = mu_max(0, rect.x);
@@ -204,22 +1057,51 @@ void r_set_clip_rect(mu_Rect rect) {
 }
 
 void r_clear(mu_Color clr) {
-    flush(); // TODO: we don't need to flush if everything will be discarded. need to reset buffidx tho.
-    for (int i = 0; i < _framebuffer.renderbuffer.width * _framebuffer.renderbuffer.height; i++) {
-        _framebuffer.renderbuffer.data[i] = r_color(clr);
-    }
+    // the clear itself happens at flush time, and only in tiles that changed.
+    // anything queued before it would be painted over anyway.
+    discard();
+    clear_color = premultiply(r_color(clr));
+    frame_cleared = true;
 }
 
 void r_present(void) {
   flush();
 }
 
+int r_get_damage(const mu_Rect **rects) {
+  *rects = damage;
+  return damage_len;
+}
+
+void r_invalidate(void) {
+  full_redraw = true;
+}
+
+/*============================================================================
+** shapes
+**
+** these queue commands like quads do. the rasterizers run at flush time, once
+** per tile the shape touches, and only write pixels inside the clip they get.
+**============================================================================*/
+
+static inline mu_Rect bounds(int x0, int y0, int x1, int y1) {
+    return mu_rect(mu_min(x0, x1), mu_min(y0, y1), abs(x1 - x0) + 1, abs(y1 - y0) + 1);
+}
+
 void r_line(int x0, int y0, int x1, int y1, uint32_t c) {
+    push_shape(R_LINE, bounds(x0, y0, x1, y1),
+               (r_shape){ .p = { {x0, y0}, {x1, y1} }, .c = { premultiply(c) } });
+}
+
+static void raster_line(const r_shape *s, mu_Rect clip) {
+    int x0 = s->p[0].x, y0 = s->p[0].y;
+    int x1 = s->p[1].x, y1 = s->p[1].y;
+    uint32_t c = s->c[0];
     int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
     int dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
     int err = (dx > dy ? dx : -dy) / 2, e2;
     for (;;) {
-        if (within_rect(_framebuffer.clip_rect, x0, y0)) {
+        if (within_rect(clip, x0, y0)) {
             r_pixel(&_framebuffer, x0, y0) = c;
         }
         if (x0 == x1 && y0 == y1) {
@@ -238,7 +1120,24 @@ void r_line(int x0, int y0, int x1, int y1, uint32_t c) {
 }
 
 void r_wu_line(int x0, int y0, int x1, int y1, uint32_t c) {
-    mu_Color line_color = mu_color_argb(c);
+    // each step also covers the next pixel down (or right)
+    mu_Rect r = bounds(x0, y0, x1, y1);
+    r.w++;
+    r.h++;
+    push_shape(R_WU_LINE, r, (r_shape){ .p = { {x0, y0}, {x1, y1} }, .c = { premultiply(c) } });
+}
+
+static inline void wu_plot(mu_Rect clip, int x, int y, uint32_t color, float alpha) {
+    if (within_rect(clip, x, y)) {
+        uint32_t *dst = &r_pixel(&_framebuffer, x, y);
+        *dst = over_pixel(*dst, scale_pixel(color, 255.0 * alpha));
+    }
+}
+
+static void raster_wu_line(const r_shape *s, mu_Rect clip) {
+    int x0 = s->p[0].x, y0 = s->p[0].y;
+    int x1 = s->p[1].x, y1 = s->p[1].y;
+    uint32_t line_color = s->c[0];
 
 #define r_swap(x, y) { int tmp = x; x = y; y = tmp; }
     if (abs(y1 - y0) < abs(x1 - x0)) {
@@ -255,20 +1154,9 @@ void r_wu_line(int x0, int y0, int x1, int y1, uint32_t c) {
             float y = y0 + i * m;
             int ix = x0 + i;
             int iy = (int)y;
-
-            if (within_rect(_framebuffer.clip_rect, ix, iy)) {
-                float dist = fabs(y - iy);
-
-                mu_Color existing_color = mu_color_argb(r_pixel(&_framebuffer, ix, iy));
-                line_color.a = 255.0 * (1.0 - dist);
-                mu_Color result = line_color.a < 255 ? blend_pixel(existing_color, line_color) : line_color;
-                r_pixel(&_framebuffer, ix, iy) = r_color(result);
-
-                existing_color = mu_color_argb(r_pixel(&_framebuffer, ix, iy + 1));
-                line_color.a = 255.0 * (dist);
-                result = line_color.a < 255 ? blend_pixel(existing_color, line_color) : line_color;
-                r_pixel(&_framebuffer, ix, iy + 1) = r_color(result);
-            }
+            float dist = fabs(y - iy);
+            wu_plot(clip, ix, iy, line_color, 1.0 - dist);
+            wu_plot(clip, ix, iy + 1, line_color, dist);
         }
 
     } else {
@@ -285,20 +1173,9 @@ void r_wu_line(int x0, int y0, int x1, int y1, uint32_t c) {
             float x = x0 + i * m;
             int ix = (int)x;
             int iy = y0 + i;
-
-            if (within_rect(_framebuffer.clip_rect, ix, iy)) {
-                float dist = fabs(x - ix);
-
-                mu_Color existing_color = mu_color_argb(r_pixel(&_framebuffer, ix, iy));
-                line_color.a = 255.0 * (1.0 - dist);
-                mu_Color result = line_color.a < 255 ? blend_pixel(existing_color, line_color) : line_color;
-                r_pixel(&_framebuffer, ix, iy) = r_color(result);
-
-                existing_color = mu_color_argb(r_pixel(&_framebuffer, ix + 1, iy));
-                line_color.a = 255.0 * (dist);
-                result = line_color.a < 255 ? blend_pixel(existing_color, line_color) : line_color;
-                r_pixel(&_framebuffer, ix + 1, iy) = r_color(result);
-            }
+            float dist = fabs(x - ix);
+            wu_plot(clip, ix, iy, line_color, 1.0 - dist);
+            wu_plot(clip, ix + 1, iy, line_color, dist);
         }
     }
 #undef r_swap
@@ -310,62 +1187,83 @@ static inline float edge_function(mu_Vec2 a, mu_Vec2 b, mu_Vec2 c) {
 }
 
 void r_triangle(mu_Vec2 a, mu_Color ca, mu_Vec2 b, mu_Color cb, mu_Vec2 c, mu_Color cc) {
-    // Calculate the edge function for the whole triangle (ABC)
-    float ABC = edge_function(a, b, c);
-
     // Our nifty trick: Don't bother drawing the triangle if it's back facing
-    if (ABC < 0) {
+    if (edge_function(a, b, c) < 0) {
         return;
     }
 
-    mu_Vec2 p = {0};
-
     // Get the bounding box of the triangle
     int minX = mu_min(a.x, mu_min(b.x, c.x));
     int minY = mu_min(a.y, mu_min(b.y, c.y));
     int maxX = mu_max(a.x, mu_max(b.x, c.x));
     int maxY = mu_max(a.y, mu_max(b.y, c.y));
 
-    // Loop through all the pixels of the bounding box
-    for (p.y = minY; p.y < maxY; p.y++) {
-        for (p.x = minX; p.x < maxX; p.x++) {
-            if (within_rect(_framebuffer.clip_rect, p.x, p.y)) {
-
-                // Calculate our edge functions
-                float ABP = edge_function(a, b, p);
-                float BCP = edge_function(b, c, p);
-                float CAP = edge_function(c, a, p);
-
-                // If all the edge functions are positive, the point is inside the triangle
-                if (ABP >= 0 && BCP >= 0 && CAP >= 0) {
-                    // Normalise the edge functions by dividing by the total area to get the barycentric coordinates
-                    float weightA = BCP / ABC;
-                    float weightB = CAP / ABC;
-                    float weightC = ABP / ABC;
-
-                    // Interpolate the colours at point P
-                    int r = ca.r * weightA + cb.r * weightB + cc.r * weightC;
-                    int g = ca.g * weightA + cb.g * weightB + cc.g * weightC;
-                    int b = ca.b * weightA + cb.b * weightB + cc.b * weightC;
-                    int a = ca.a * weightA + cb.a * weightB + cc.a * weightC;
-                    mu_Color cp = mu_color(r, g, b, a);
-
-                    // Draw the pixel
-                    mu_Color existing_color = mu_color_argb(r_pixel(&_framebuffer, p.x, p.y));
-                    mu_Color result = a < 255 ? blend_pixel(existing_color, cp) : cp;
-                    r_pixel(&_framebuffer, p.x, p.y) = r_color(result);
+    push_shape(R_TRIANGLE, mu_rect(minX, minY, maxX - minX, maxY - minY),
+               (r_shape){ .p = { a, b, c }, .c = { premultiply(r_color(ca)), premultiply(r_color(cb)), premultiply(r_color(cc)) } });
+}
+
+static void raster_triangle(const r_shape *s, mu_Rect clip) {
+    mu_Vec2 a = s->p[0], b = s->p[1], c = s->p[2];
+    // unpacked once, the colors are interpolated per channel. the vertex colors
+    // are premultiplied, so no channel ends up above the interpolated alpha
+    float ch[3][4];
+    for (int v = 0; v < 3; v++) {
+        for (int k = 0; k < 4; k++) {
+            ch[v][k] = (s->c[v] >> (24 - 8 * k)) & 0xff;
+        }
+    }
+
+    // Calculate the edge function for the whole triangle (ABC)
+    float ABC = edge_function(a, b, c);
+
+    mu_Vec2 p = {0};
+
+    // Loop through all the pixels of the bounding box. clip is already inside it.
+    for (p.y = clip.y; p.y < clip.y + clip.h; p.y++) {
+        for (p.x = clip.x; p.x < clip.x + clip.w; p.x++) {
+            // Calculate our edge functions
+            float ABP = edge_function(a, b, p);
+            float BCP = edge_function(b, c, p);
+            float CAP = edge_function(c, a, p);
+
+            // If all the edge functions are positive, the point is inside the triangle
+            if (ABP >= 0 && BCP >= 0 && CAP >= 0) {
+                // Normalise the edge functions by dividing by the total area to get the barycentric coordinates
+                float weightA = BCP / ABC;
+                float weightB = CAP / ABC;
+                float weightC = ABP / ABC;
+
+                // Interpolate the colours at point P, a r g b
+                uint32_t cp = 0;
+                for (int k = 0; k < 4; k++) {
+                    int v = ch[0][k] * weightA + ch[1][k] * weightB + ch[2][k] * weightC;
+                    cp = cp << 8 | (v & 0xff);
                 }
+
+                // Draw the pixel
+                uint32_t *dst = &r_pixel(&_framebuffer, p.x, p.y);
+                *dst = over_pixel(*dst, cp);
             }
         }
     }
 }
 
-// https://www.computerenhance.com/p/efficient-dda-circle-outlines
+static inline mu_Rect circle_bounds(mu_Vec2 center, int radius) {
+    return mu_rect(center.x - radius, center.y - radius, radius * 2 + 1, radius * 2 + 1);
+}
+
 void r_circle(mu_Vec2 center, int radius, mu_Color color) {
+    push_shape(R_CIRCLE, circle_bounds(center, radius),
+               (r_shape){ .p = { center }, .c = { premultiply(r_color(color)) }, .radius = radius });
+}
+
+// https://www.computerenhance.com/p/efficient-dda-circle-outlines
+static void raster_circle(const r_shape *s, mu_Rect clip) {
     // NOTE(casey): Center and radius of the circle
-    int Cx = center.x;
-    int Cy = center.y;
-    int R = radius;
+    int Cx = s->p[0].x;
+    int Cy = s->p[0].y;
+    int R = s->radius;
+    uint32_t color = s->c[0];
 
     // NOTE(casey): Loop that draws the circle
     {
@@ -378,14 +1276,14 @@ void r_circle(mu_Vec2 center, int radius, mu_Color color) {
         int D = R2 - 1;
 
         while(Y <= X) {
-            if (within_rect(_framebuffer.clip_rect, Cx - X, Cy - Y)) { r_pixel(&_framebuffer, Cx - X, Cy - Y) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx + X, Cy - Y)) { r_pixel(&_framebuffer, Cx + X, Cy - Y) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx - X, Cy + Y)) { r_pixel(&_framebuffer, Cx - X, Cy + Y) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx + X, Cy + Y)) { r_pixel(&_framebuffer, Cx + X, Cy + Y) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx - Y, Cy - X)) { r_pixel(&_framebuffer, Cx - Y, Cy - X) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx + Y, Cy - X)) { r_pixel(&_framebuffer, Cx + Y, Cy - X) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx - Y, Cy + X)) { r_pixel(&_framebuffer, Cx - Y, Cy + X) = r_color(color); }
-            if (within_rect(_framebuffer.clip_rect, Cx + Y, Cy + X)) { r_pixel(&_framebuffer, Cx + Y, Cy + X) = r_color(color); }
+            if (within_rect(clip, Cx - X, Cy - Y)) { r_pixel(&_framebuffer, Cx - X, Cy - Y) = color; }
+            if (within_rect(clip, Cx + X, Cy - Y)) { r_pixel(&_framebuffer, Cx + X, Cy - Y) = color; }
+            if (within_rect(clip, Cx - X, Cy + Y)) { r_pixel(&_framebuffer, Cx - X, Cy + Y) = color; }
+            if (within_rect(clip, Cx + X, Cy + Y)) { r_pixel(&_framebuffer, Cx + X, Cy + Y) = color; }
+            if (within_rect(clip, Cx - Y, Cy - X)) { r_pixel(&_framebuffer, Cx - Y, Cy - X) = color; }
+            if (within_rect(clip, Cx + Y, Cy - X)) { r_pixel(&_framebuffer, Cx + Y, Cy - X) = color; }
+            if (within_rect(clip, Cx - Y, Cy + X)) { r_pixel(&_framebuffer, Cx - Y, Cy + X) = color; }
+            if (within_rect(clip, Cx + Y, Cy + X)) { r_pixel(&_framebuffer, Cx + Y, Cy + X) = color; }
 
             D += dY;
             dY -= 4;
@@ -409,14 +1307,23 @@ void r_circle(mu_Vec2 center, int radius, mu_Color color) {
     }
 }
 
+void r_fill_circle(mu_Vec2 center, int radius, mu_Color color) {
+    push_shape(R_FILL_CIRCLE, circle_bounds(center, radius),
+               (r_shape){ .p = { center }, .c = { premultiply(r_color(color)) }, .radius = radius });
+}
+
 // filled circle
 // https://web.archive.org/web/20120422045142/https://banu.com/blog/7/drawing-circles/
 // https://yellowsplash.wordpress.com/2009/10/23/fast-antialiased-circles-and-ellipses-from-xiaolin-wus-concepts/
-void r_fill_circle(mu_Vec2 center, int radius, mu_Color color) {
-    for (int y = -radius; y <= radius; y++) {
-        for (int x = -radius; x <= radius; x++) {
-            if ((x * x) + (y * y) <= (radius * radius) && within_rect(_framebuffer.clip_rect, center.x + x, center.y + y)) {
-                r_pixel(&_framebuffer, center.x + x, center.y + y) = r_color(color);
+static void raster_fill_circle(const r_shape *s, mu_Rect clip) {
+    mu_Vec2 center = s->p[0];
+    int radius = s->radius;
+    uint32_t color = s->c[0];
+    // clip is inside the circle's bounds, so only walk that part of it
+    for (int y = clip.y - center.y; y < clip.y + clip.h - center.y; y++) {
+        for (int x = clip.x - center.x; x < clip.x + clip.w - center.x; x++) {
+            if ((x * x) + (y * y) <= (radius * radius)) {
+                r_pixel(&_framebuffer, center.x + x, center.y + y) = color;
             }
         }
     }
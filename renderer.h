@@ -3,15 +3,26 @@
 
 #include "microui.h"
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// mu_Color packed as 0xAARRGGBB with straight alpha. the framebuffer uses the
+// same layout premultiplied: each color channel is already scaled by alpha / 255
+// and the alpha channel is the pixel's opacity, so it can be composited as is.
+static inline uint32_t r_color(mu_Color clr) {
+    return ((uint32_t)clr.a << 24) | ((uint32_t)clr.r << 16) | ((uint32_t)clr.g << 8) | clr.b;
+}
+
 typedef struct {
     uint32_t *data;
     const int width;
     const int height;
 } r_renderbuffer;
 
-void r_init(r_renderbuffer renderbuffer);
+// threads > 1 rasterizes binned batches on a pool of that many threads,
+// the calling thread included.
+void r_init(r_renderbuffer renderbuffer, int threads);
 void r_draw_rect(mu_Rect rect, mu_Color color);
 void r_draw_text(const char *text, mu_Vec2 pos, mu_Color color);
 void r_draw_icon(int id, mu_Rect rect, mu_Color color);
@@ -20,7 +31,28 @@ void r_draw_icon(int id, mu_Rect rect, mu_Color color);
 void r_set_clip_rect(mu_Rect rect);
 void r_clear(mu_Color color);
 void r_present(void);
+void r_set_binning(bool enabled);
+
+// screen rects that changed in the last r_present(). valid until the next one.
+// tiles whose commands, clip rects and clear color match the previous frame
+// are skipped entirely; r_invalidate() forces a full redraw.
+int r_get_damage(const mu_Rect **rects);
+void r_invalidate(void);
+
+// strings are drawn from whole-text coverage masks, cached by their text and
+// evicted least recently used first once they hold more than the budget.
+// the counters run from program start.
+typedef struct {
+    uint64_t hits, misses, evictions;
+    int entries;
+    size_t bytes, budget;
+} r_text_cache_stats;
+
+r_text_cache_stats r_get_text_cache_stats(void);
+void r_set_text_cache_budget(size_t bytes);
 
+// shapes are queued like everything else and drawn in order at r_present().
+// line colors are straight argb, as r_color() packs them.
 void r_line(int x0, int y0, int x1, int y1, uint32_t c);
 void r_wu_line(int x0, int y0, int x1, int y1, uint32_t c);
 void r_triangle(mu_Vec2 a, mu_Color ca, mu_Vec2 b, mu_Color cb, mu_Vec2 c, mu_Color cc);
@@ -0,0 +1,101 @@
+// a retained window that is being replayed must keep its panels and open
+// treenodes in the pools, even when other windows and treenodes churn through
+// them, so that the next rebuild finds its scroll and expansion state again.
+//
+// usage: make test
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "microui.h"
+
+static mu_Rect tree_rect;
+static int tree_open;
+static int panel_scroll;
+
+static int text_width(mu_Font font, const char *text, int len) {
+    (void)font;
+    return 8 * (len < 0 ? (int)strlen(text) : len);
+}
+
+static int text_height(mu_Font font) {
+    (void)font;
+    return 18;
+}
+
+static void frame(mu_Context *ctx, int set_scroll, int first_other, int others) {
+    mu_begin(ctx);
+    if (mu_begin_window_retained(ctx, "W", mu_rect(0, 0, 200, 300), 0, 0)) {
+        mu_layout_row(ctx, 1, (int[]) { -1 }, 100);
+        mu_begin_panel(ctx, "Panel");
+        mu_Container *panel = mu_get_current_container(ctx);
+        mu_layout_row(ctx, 1, (int[]) { -1 }, 0);
+        for (int i = 0; i < 20; i++) { mu_label(ctx, "row"); }
+        if (set_scroll) { panel->scroll.y = 37; }
+        panel_scroll = panel->scroll.y;
+        mu_end_panel(ctx);
+
+        tree_open = mu_begin_treenode(ctx, "Tree");
+        tree_rect = ctx->last_rect;
+        if (tree_open) {
+            mu_label(ctx, "leaf");
+            mu_end_treenode(ctx);
+        }
+        mu_end_window(ctx);
+    }
+
+    // other windows take container slots, other treenodes take treenode slots
+    for (int i = first_other; i < first_other + others; i++) {
+        char title[32];
+        sprintf(title, "Other %d", i);
+        if (mu_begin_window(ctx, title, mu_rect(400 + i % 10, 0, 100, 100))) {
+            mu_end_window(ctx);
+        }
+    }
+    for (int i = 0; i < others * 5; i++) {
+        mu_pool_init(ctx, &ctx->treenode_pool, 0x10000 + first_other * 5 + i);
+    }
+    mu_end(ctx);
+}
+
+static int check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+    return ok;
+}
+
+int main(void) {
+    mu_Context *ctx = malloc(sizeof(mu_Context));
+    mu_init(ctx, NULL);
+    ctx->text_width = text_width;
+    ctx->text_height = text_height;
+
+    // build the window under the mouse, open the treenode and scroll the panel
+    mu_input_mousemove(ctx, 100, 150);
+    frame(ctx, 0, 0, 0);
+    frame(ctx, 0, 0, 0);
+    mu_input_mousemove(ctx, tree_rect.x + 5, tree_rect.y + 5);
+    mu_input_mousedown(ctx, tree_rect.x + 5, tree_rect.y + 5, MU_MOUSE_LEFT);
+    frame(ctx, 0, 0, 0);
+    mu_input_mouseup(ctx, tree_rect.x + 5, tree_rect.y + 5, MU_MOUSE_LEFT);
+    frame(ctx, 1, 0, 0);
+
+    // move away: one more build is recorded, after that the window replays
+    // while 240 windows and 1200 treenodes pass through the pools
+    mu_input_mousemove(ctx, 1000, 1000);
+    frame(ctx, 0, 0, 0);
+    frame(ctx, 0, 0, 0);
+    for (int f = 0; f < 6; f++) {
+        frame(ctx, 0, f * 40, 40);
+    }
+
+    // back over the window: it is built again
+    mu_input_mousemove(ctx, 100, 150);
+    frame(ctx, 0, 0, 0);
+
+    int ok = check(panel_scroll == 37, "panel scroll survives replays");
+    ok &= check(tree_open, "treenode stays open across replays");
+    mu_free(ctx);
+    free(ctx);
+    return !ok;
+}